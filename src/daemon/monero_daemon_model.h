@@ -57,6 +57,8 @@
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
+#include "utils/gen_utils.h"
+#include "utils/monero_lazy_hex.h"
 
 /**
  * Public interface for libmonero-cpp library.
@@ -168,43 +170,43 @@ namespace monero {
   struct monero_tx : public serializable_struct {
     static const std::string DEFAULT_PAYMENT_ID;  // default payment id "0000000000000000"
     boost::optional<std::shared_ptr<monero_block>> m_block;
-    boost::optional<std::string> m_hash;
-    boost::optional<uint32_t> m_version;
-    boost::optional<bool> m_is_miner_tx;
-    boost::optional<std::string> m_payment_id;
+    monero_lazy_hex m_hash;
+    monero_lazy_hex m_payment_id;
     boost::optional<uint64_t> m_fee;
-    boost::optional<uint32_t> m_ring_size;
-    boost::optional<bool> m_relay;
-    boost::optional<bool> m_is_relayed;
-    boost::optional<bool> m_is_confirmed;
-    boost::optional<bool> m_in_tx_pool;
     boost::optional<uint64_t> m_num_confirmations;
     boost::optional<uint64_t> m_unlock_time;
     boost::optional<uint64_t> m_last_relayed_timestamp;
     boost::optional<uint64_t> m_received_timestamp;
-    boost::optional<bool> m_is_double_spend_seen;
-    boost::optional<std::string> m_key;
-    boost::optional<std::string> m_full_hex;
-    boost::optional<std::string> m_pruned_hex;
-    boost::optional<std::string> m_prunable_hex;
-    boost::optional<std::string> m_prunable_hash;
     boost::optional<uint64_t> m_size;
     boost::optional<uint64_t> m_weight;
+    boost::optional<uint64_t> m_last_failed_height;
+    boost::optional<uint64_t> m_max_used_block_height;
+    boost::optional<uint32_t> m_version;
+    boost::optional<uint32_t> m_ring_size;
+    boost::optional<bool> m_is_miner_tx;    // flags are grouped to pack without padding
+    boost::optional<bool> m_relay;
+    boost::optional<bool> m_is_relayed;
+    boost::optional<bool> m_is_confirmed;
+    boost::optional<bool> m_in_tx_pool;
+    boost::optional<bool> m_is_double_spend_seen;
+    boost::optional<bool> m_is_kept_by_block;
+    boost::optional<bool> m_is_failed;
     std::vector<std::shared_ptr<monero_output>> m_inputs;
     std::vector<std::shared_ptr<monero_output>> m_outputs;
     std::vector<uint32_t> m_output_indices;
-    boost::optional<std::string> m_metadata;
-    boost::optional<std::string> m_common_tx_sets;
     std::vector<uint8_t> m_extra;
-    boost::optional<std::string> m_rct_signatures;   // TODO: implement
-    boost::optional<std::string> m_rct_sig_prunable;  // TODO: implement
-    boost::optional<bool> m_is_kept_by_block;
-    boost::optional<bool> m_is_failed;
-    boost::optional<uint64_t> m_last_failed_height;
-    boost::optional<std::string> m_last_failed_hash;
-    boost::optional<uint64_t> m_max_used_block_height;
-    boost::optional<std::string> m_max_used_block_hash;
     std::vector<std::string> m_signatures;
+    gen_utils::boxed_optional<std::string> m_key;  // rarely set strings are allocated on demand
+    gen_utils::boxed_optional<std::string> m_full_hex;
+    gen_utils::boxed_optional<std::string> m_pruned_hex;
+    gen_utils::boxed_optional<std::string> m_prunable_hex;
+    gen_utils::boxed_optional<std::string> m_prunable_hash;
+    gen_utils::boxed_optional<std::string> m_metadata;
+    gen_utils::boxed_optional<std::string> m_common_tx_sets;
+    gen_utils::boxed_optional<std::string> m_rct_signatures;   // TODO: implement
+    gen_utils::boxed_optional<std::string> m_rct_sig_prunable;  // TODO: implement
+    gen_utils::boxed_optional<std::string> m_last_failed_hash;
+    gen_utils::boxed_optional<std::string> m_max_used_block_hash;
 
     rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
     static void from_property_tree(const boost::property_tree::ptree& node, std::shared_ptr<monero_tx> tx);
@@ -217,7 +219,7 @@ namespace monero {
    * Models a Monero key image.
    */
   struct monero_key_image : public serializable_struct {
-    boost::optional<std::string> m_hex;
+    monero_lazy_hex m_hex;
     boost::optional<std::string> m_signature;
 
     rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
@@ -236,7 +238,7 @@ namespace monero {
     boost::optional<uint64_t> m_amount;
     boost::optional<uint64_t> m_index;
     std::vector<uint64_t> m_ring_output_indices;
-    boost::optional<std::string> m_stealth_public_key;
+    monero_lazy_hex m_stealth_public_key;
 
     rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
     static void from_property_tree(const boost::property_tree::ptree& node, const std::shared_ptr<monero_output>& output);
@@ -56,6 +56,10 @@
 
 #include "include_base_utils.h"
 #include "common/util.h"
+#include "monero_lazy_hex.h"
+#include <functional>
+#include <memory>
+#include <vector>
 
 /**
  * Collection of utilities for working with Monero's binary portable storage format.
@@ -146,5 +150,178 @@ namespace gen_utils
     // otherwise cannot reconcile
     throw std::runtime_error("Cannot reconcile vectors" + (!err_msg.empty() ? std::string(". ") + err_msg : std::string("")));
   }
+
+  // ---------------------------- BOXED OPTIONAL ------------------------------
+
+  /**
+   * Optional value which is allocated only when set.
+   *
+   * Occupies one pointer when unset, so it suits large fields which are rarely
+   * initialized.  Supports the subset of boost::optional used by the models so
+   * fields can switch between the two without changing their callers.
+   */
+  template <class T>
+  class boxed_optional {
+
+  public:
+    boxed_optional() { }
+    boxed_optional(boost::none_t) { }
+    boxed_optional(const boxed_optional& other) : m_val(other.m_val ? new T(*other.m_val) : nullptr) { }
+    boxed_optional(boxed_optional&& other) : m_val(std::move(other.m_val)) { }
+    boxed_optional(const boost::optional<T>& val) : m_val(val ? new T(*val) : nullptr) { }
+    template <class U, typename std::enable_if<!std::is_same<typename std::decay<U>::type, boxed_optional>::value && std::is_constructible<T, U&&>::value>::type* = nullptr>
+    boxed_optional(U&& val) : m_val(new T(std::forward<U>(val))) { }
+
+    boxed_optional& operator=(boxed_optional other) {
+      m_val.swap(other.m_val);
+      return *this;
+    }
+
+    bool is_initialized() const { return static_cast<bool>(m_val); }
+    explicit operator bool() const { return is_initialized(); }
+
+    T& get() {
+      if (!m_val) throw std::runtime_error("Optional value is not initialized");
+      return *m_val;
+    }
+    const T& get() const {
+      if (!m_val) throw std::runtime_error("Optional value is not initialized");
+      return *m_val;
+    }
+    T& operator*() { return get(); }
+    const T& operator*() const { return get(); }
+    T* operator->() { return &get(); }
+    const T* operator->() const { return &get(); }
+
+    boost::optional<T> to_optional() const { return m_val ? boost::optional<T>(*m_val) : boost::none; }
+    operator boost::optional<T>() const { return to_optional(); }
+
+    bool operator==(boost::none_t) const { return !m_val; }
+    bool operator!=(boost::none_t) const { return static_cast<bool>(m_val); }
+    bool operator==(const T& val) const { return m_val && *m_val == val; }
+    bool operator!=(const T& val) const { return !(*this == val); }
+    bool operator==(const char* val) const { return m_val && *m_val == val; }
+    bool operator!=(const char* val) const { return !(*this == val); }
+    bool operator==(const boxed_optional& other) const { return m_val ? other.m_val && *m_val == *other.m_val : !other.m_val; }
+    bool operator!=(const boxed_optional& other) const { return !(*this == other); }
+
+  private:
+    std::unique_ptr<T> m_val;
+  };
+
+  template <class T>
+  boost::optional<T> reconcile(const boxed_optional<T>& val1, const boxed_optional<T>& val2, const std::string& err_msg = "") {
+    return reconcile(val1.to_optional(), val2.to_optional(), err_msg);
+  }
+
+  /**
+   * Reconcile lazy hex values by their binary form so hex is only materialized on conflict.
+   */
+  inline monero::monero_lazy_hex reconcile(const monero::monero_lazy_hex& val1, const monero::monero_lazy_hex& val2, const std::string& err_msg = "") {
+    if (val1 == val2) return val1;
+    if (val1 == boost::none) return val2;
+    if (val2 == boost::none) return val1;
+    throw std::runtime_error(std::string("Cannot reconcile strings: ") + *val1 + std::string(" vs ") + *val2 + (!err_msg.empty() ? std::string(". ") + err_msg : std::string("")));
+  }
+
+  // ------------------------ INSERTION ORDERED HASH MAP ----------------------
+
+  /**
+   * Open addressing hash map which iterates in insertion order.
+   *
+   * Entries are stored contiguously and located through a linear probing table of
+   * entry positions, so inserts and lookups make no per-entry allocations.  Entries
+   * cannot be erased; build a new map to drop entries.
+   */
+  template <class K, class V, class H = std::hash<K>>
+  class ordered_hash_map {
+
+  public:
+    typedef std::pair<K, V> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    ordered_hash_map() : m_shift(64) { }
+
+    size_t size() const { return m_entries.size(); }
+    bool empty() const { return m_entries.empty(); }
+    iterator begin() { return m_entries.begin(); }
+    iterator end() { return m_entries.end(); }
+    const_iterator begin() const { return m_entries.begin(); }
+    const_iterator end() const { return m_entries.end(); }
+
+    void reserve(size_t num_entries) {
+      m_entries.reserve(num_entries);
+      if (num_entries * 2 > m_slots.size()) rehash(num_entries * 2);
+    }
+
+    void clear() {
+      m_entries.clear();
+      std::fill(m_slots.begin(), m_slots.end(), EMPTY);
+    }
+
+    /**
+     * Get the value mapped to a key.
+     *
+     * @param key is the key to find
+     * @return a pointer to the key's value, nullptr if the key is not mapped
+     */
+    V* find(const K& key) {
+      if (m_slots.empty()) return nullptr;
+      uint32_t pos = m_slots[probe(key)];
+      return pos == EMPTY ? nullptr : &m_entries[pos].second;
+    }
+    const V* find(const K& key) const {
+      return const_cast<ordered_hash_map*>(this)->find(key);
+    }
+
+    /**
+     * Map a key to a value unless the key is already mapped.
+     *
+     * @param key is the key to map
+     * @param value is the value to map the key to
+     * @return a pointer to the key's value and true if inserted, false if the key was already mapped
+     */
+    std::pair<V*, bool> insert(const K& key, const V& value) {
+      if ((m_entries.size() + 1) * 2 > m_slots.size()) rehash(std::max((size_t) 16, m_slots.size() * 2));
+      size_t slot = probe(key);
+      if (m_slots[slot] != EMPTY) return std::make_pair(&m_entries[m_slots[slot]].second, false);
+      m_slots[slot] = (uint32_t) m_entries.size();
+      m_entries.push_back(value_type(key, value));
+      return std::make_pair(&m_entries.back().second, true);
+    }
+
+    V& operator[](const K& key) {
+      return *insert(key, V()).first;
+    }
+
+  private:
+    static const uint32_t EMPTY = 0xFFFFFFFF;
+    std::vector<value_type> m_entries;   // entries in insertion order
+    std::vector<uint32_t> m_slots;       // positions of entries by hash, power of 2 size
+    unsigned m_shift;                    // 64 - log2 of the number of slots
+    H m_hasher;
+
+    // slot of the key, or of the empty slot where it would be inserted
+    size_t probe(const K& key) const {
+      size_t mask = m_slots.size() - 1;
+      size_t slot = (size_t) (((uint64_t) m_hasher(key) * 0x9E3779B97F4A7C15ull) >> m_shift); // spread low entropy hashes (e.g. heights)
+      while (m_slots[slot] != EMPTY && !(m_entries[m_slots[slot]].first == key)) slot = (slot + 1) & mask;
+      return slot;
+    }
+
+    void rehash(size_t min_slots) {
+      size_t num_slots = 16;
+      m_shift = 60;
+      while (num_slots < min_slots) {
+        num_slots *= 2;
+        m_shift--;
+      }
+      m_slots.assign(num_slots, EMPTY);
+      for (uint32_t pos = 0; pos < m_entries.size(); pos++) m_slots[probe(m_entries[pos].first)] = pos;
+    }
+  };
+  template <class K, class V, class H>
+  const uint32_t ordered_hash_map<K, V, H>::EMPTY;
 }
 #endif /* gen_utils_h */
@@ -0,0 +1,161 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_lazy_hex.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace monero {
+
+  // ----------------------- UNDECLARED PRIVATE HELPERS -----------------------
+
+  static const char HEX_CHARS[] = "0123456789abcdef";
+
+  int hex_char_to_int(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  bool is_lowercase_hex(const std::string& str) {
+    for (char c : str) {
+      if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+    }
+    return true;
+  }
+
+  bool hex_to_binary(const std::string& hex, uint8_t* data, size_t size) {
+    if (hex.size() != size * 2) return false;
+    for (size_t i = 0; i < size; i++) {
+      int hi = hex_char_to_int(hex[2 * i]);
+      int lo = hex_char_to_int(hex[2 * i + 1]);
+      if (hi < 0 || lo < 0) return false;
+      data[i] = (uint8_t) ((hi << 4) | lo);
+    }
+    return true;
+  }
+
+  // ---------------------------- MONERO LAZY HEX -----------------------------
+
+  monero_lazy_hex::monero_lazy_hex(const monero_lazy_hex& other) : monero_lazy_hex() {
+    *this = other;
+  }
+
+  monero_lazy_hex& monero_lazy_hex::operator=(const monero_lazy_hex& other) {
+    if (this == &other) return *this;
+    reset();
+    m_is_initialized = other.m_is_initialized;
+    m_size = other.m_size;
+    if (m_size > 0) memcpy(m_binary, other.m_binary, m_size); // hex is materialized again on read
+    else if (m_is_initialized) m_str = new std::string(*other.m_str.load());
+    return *this;
+  }
+
+  void monero_lazy_hex::set_binary(const void* data, size_t size) {
+    if (size == 0 || size > MAX_BINARY_SIZE) throw std::runtime_error("Binary value must be 1 to 32 bytes but was " + std::to_string(size));
+    reset();
+    m_is_initialized = true;
+    m_size = (uint8_t) size;
+    memcpy(m_binary, data, size);
+  }
+
+  bool monero_lazy_hex::get_binary(void* data, size_t size) const {
+    if (!m_is_initialized) return false;
+    if (m_size == 0) return hex_to_binary(*m_str.load(), static_cast<uint8_t*>(data), size);
+    if (m_size != size) return false;
+    memcpy(data, m_binary, size);
+    return true;
+  }
+
+  const std::string& monero_lazy_hex::get() const {
+    if (!m_is_initialized) throw std::runtime_error("Hex value is not initialized");
+    std::string* str = m_str.load();
+    if (str != nullptr) return *str;
+
+    // materialize hex and publish it unless another thread did first
+    std::string* hex = new std::string(m_size * 2, '0');
+    for (size_t i = 0; i < m_size; i++) {
+      (*hex)[2 * i] = HEX_CHARS[m_binary[i] >> 4];
+      (*hex)[2 * i + 1] = HEX_CHARS[m_binary[i] & 0x0F];
+    }
+    if (m_str.compare_exchange_strong(str, hex)) return *hex;
+    delete hex;
+    return *str;
+  }
+
+  bool monero_lazy_hex::operator==(const monero_lazy_hex& other) const {
+    if (!m_is_initialized || !other.m_is_initialized) return m_is_initialized == other.m_is_initialized;
+    if (m_size > 0 && other.m_size > 0) return m_size == other.m_size && memcmp(m_binary, other.m_binary, m_size) == 0;
+    return get() == other.get();
+  }
+
+  // ------------------------------- PRIVATE HELPERS ----------------------------
+
+  void monero_lazy_hex::set(const std::string& str) {
+    reset();
+    m_is_initialized = true;
+    if (!str.empty() && str.size() % 2 == 0 && str.size() <= MAX_BINARY_SIZE * 2 && is_lowercase_hex(str)) {
+      m_size = (uint8_t) (str.size() / 2);
+      hex_to_binary(str, m_binary, m_size);
+    } else {
+      m_str = new std::string(str);
+    }
+  }
+
+  void monero_lazy_hex::reset() {
+    delete m_str.exchange(nullptr);
+    m_is_initialized = false;
+    m_size = 0;
+  }
+}
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include <boost/optional.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Optional hex string stored as binary until its hex is read.
+ */
+namespace monero {
+
+  /**
+   * Drop-in replacement for boost::optional<std::string> holding hex of a hash, key, or
+   * key image.
+   *
+   * Values set from binary, or from non-empty lowercase hex of up to 32 bytes, are stored
+   * in place as binary.  The hex string is allocated the first time it is read and then cached.
+   * Other strings are stored as given.  Reading the hex of the same value from multiple
+   * threads is safe.
+   */
+  class monero_lazy_hex {
+
+  public:
+    static const size_t MAX_BINARY_SIZE = 32;
+
+    monero_lazy_hex() : m_is_initialized(false), m_size(0), m_str(nullptr) { }
+    monero_lazy_hex(boost::none_t) : monero_lazy_hex() { }
+    monero_lazy_hex(const std::string& str) : monero_lazy_hex() { set(str); }
+    monero_lazy_hex(const char* str) : monero_lazy_hex() { set(std::string(str)); }
+    monero_lazy_hex(const boost::optional<std::string>& str) : monero_lazy_hex() { if (str != boost::none) set(*str); }
+    monero_lazy_hex(const monero_lazy_hex& other);
+    monero_lazy_hex& operator=(const monero_lazy_hex& other);
+    ~monero_lazy_hex() { delete m_str.load(); }
+
+    /**
+     * Create from a binary value whose hex is the value's bytes in order.
+     *
+     * @param pod is the binary value (e.g. crypto::hash, crypto::key_image)
+     */
+    template <class T>
+    static monero_lazy_hex from_pod(const T& pod) {
+      static_assert(sizeof(T) <= MAX_BINARY_SIZE, "Binary value is too large");
+      monero_lazy_hex hex;
+      hex.set_binary(&pod, sizeof(T));
+      return hex;
+    }
+
+    /**
+     * Set the value from binary.
+     *
+     * @param data is the binary value
+     * @param size is the number of bytes, from 1 to MAX_BINARY_SIZE
+     */
+    void set_binary(const void* data, size_t size);
+
+    /**
+     * Get the value as binary without materializing its hex.
+     *
+     * @param pod is set to the binary value
+     * @return true if the value is hex of exactly sizeof(T) bytes, false otherwise
+     */
+    template <class T>
+    bool get_pod(T& pod) const {
+      return get_binary(&pod, sizeof(T));
+    }
+    bool get_binary(void* data, size_t size) const;
+
+    bool is_initialized() const { return m_is_initialized; }
+    explicit operator bool() const { return m_is_initialized; }
+
+    /**
+     * Get the hex string, materializing it on first read.
+     *
+     * @throws std::runtime_error if the value is none
+     */
+    const std::string& get() const;
+    const std::string& operator*() const { return get(); }
+    const std::string* operator->() const { return &get(); }
+    boost::optional<std::string> to_optional() const { return m_is_initialized ? boost::optional<std::string>(get()) : boost::none; }
+    operator boost::optional<std::string>() const { return to_optional(); }
+
+    bool operator==(const monero_lazy_hex& other) const;
+    bool operator!=(const monero_lazy_hex& other) const { return !(*this == other); }
+    bool operator==(const std::string& str) const { return m_is_initialized && get() == str; }
+    bool operator!=(const std::string& str) const { return !(*this == str); }
+    bool operator==(const char* str) const { return *this == std::string(str); }
+    bool operator!=(const char* str) const { return !(*this == str); }
+    bool operator==(boost::none_t) const { return !m_is_initialized; }
+    bool operator!=(boost::none_t) const { return m_is_initialized; }
+
+    // --------------------------------- PRIVATE --------------------------------
+
+  private:
+    bool m_is_initialized;                         // false if none
+    uint8_t m_size;                                // number of binary bytes, 0 if stored as given
+    uint8_t m_binary[MAX_BINARY_SIZE];             // binary value
+    mutable std::atomic<std::string*> m_str;       // materialized hex or string stored as given
+    void set(const std::string& str);
+    void reset();
+  };
+
+  inline bool operator==(const std::string& str, const monero_lazy_hex& hex) { return hex == str; }
+  inline bool operator!=(const std::string& str, const monero_lazy_hex& hex) { return hex != str; }
+  inline bool operator==(boost::none_t, const monero_lazy_hex& hex) { return hex == boost::none; }
+  inline bool operator!=(boost::none_t, const monero_lazy_hex& hex) { return hex != boost::none; }
+}
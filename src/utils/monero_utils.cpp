@@ -265,7 +265,7 @@ std::shared_ptr<monero_tx> monero_utils::cn_tx_to_tx(const cryptonote::transacti
   std::shared_ptr<monero_tx> tx = init_as_tx_wallet ? std::make_shared<monero_tx_wallet>() : std::make_shared<monero_tx>();
   tx->m_version = cn_tx.version;
   tx->m_unlock_time = cn_tx.unlock_time;
-  tx->m_hash = epee::string_tools::pod_to_hex(cn_tx.hash);
+  tx->m_hash = monero_lazy_hex::from_pod(cn_tx.hash);
   tx->m_extra = cn_tx.extra;
 
   // init inputs
@@ -281,7 +281,7 @@ std::shared_ptr<monero_tx> monero_utils::cn_tx_to_tx(const cryptonote::transacti
     input->m_ring_output_indices = txin.key_offsets;
     crypto::key_image cnKeyImage = txin.k_image;
     input->m_key_image = std::make_shared<monero_key_image>();
-    input->m_key_image.get()->m_hex = epee::string_tools::pod_to_hex(cnKeyImage);
+    input->m_key_image.get()->m_hex = monero_lazy_hex::from_pod(cnKeyImage);
   }
 
   // init outputs
@@ -291,7 +291,7 @@ std::shared_ptr<monero_tx> monero_utils::cn_tx_to_tx(const cryptonote::transacti
     tx->m_outputs.push_back(output);
     output->m_amount = cnVout.amount;
     const crypto::public_key& cnStealthPublicKey = boost::get<txout_to_key>(cnVout.target).key;
-    output->m_stealth_public_key = epee::string_tools::pod_to_hex(cnStealthPublicKey);
+    output->m_stealth_public_key = monero_lazy_hex::from_pod(cnStealthPublicKey);
   }
 
   return tx;
@@ -0,0 +1,228 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_async_listener.h"
+
+#include "misc_log_ex.h"
+
+namespace monero {
+
+  const size_t monero_async_listener::DEFAULT_CAPACITY;
+
+  monero_async_listener::monero_async_listener(monero_wallet_listener& listener, size_t capacity, backpressure_policy policy) : m_listener(listener), m_capacity(std::max(capacity, (size_t) 1)), m_policy(policy), m_num_dequeued(0), m_latest(), m_metrics(), m_is_stopping(false) {
+    m_delivery_thread = boost::thread([this]() { run_delivery(); });
+  }
+
+  monero_async_listener::~monero_async_listener() {
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_is_stopping = true;
+    }
+    m_not_empty_cv.notify_all();
+    m_delivery_thread.join();
+  }
+
+  monero_async_listener::metrics monero_async_listener::get_metrics() const {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    metrics snapshot = m_metrics;
+    snapshot.m_depth = m_queue.size();
+    snapshot.m_lag_ms = m_queue.empty() ? 0 : std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_queue.front().m_time).count();
+    return snapshot;
+  }
+
+  void monero_async_listener::on_sync_progress(uint64_t height, uint64_t start_height, uint64_t end_height, double percent_done, const std::string& message) {
+    event e = event();
+    e.m_type = SYNC_PROGRESS;
+    e.m_height = height;
+    e.m_start_height = start_height;
+    e.m_end_height = end_height;
+    e.m_percent_done = percent_done;
+    e.m_message = message;
+    enqueue(e);
+  }
+
+  void monero_async_listener::on_new_block(uint64_t height) {
+    event e = event();
+    e.m_type = NEW_BLOCK;
+    e.m_height = height;
+    enqueue(e);
+  }
+
+  void monero_async_listener::on_balances_changed(uint64_t new_balance, uint64_t new_unlocked_balance) {
+    event e = event();
+    e.m_type = BALANCES_CHANGED;
+    e.m_balance = new_balance;
+    e.m_unlocked_balance = new_unlocked_balance;
+    enqueue(e);
+  }
+
+  // outputs notified individually are owned by the notifier, so a copy is queued
+  void monero_async_listener::on_output_received(const monero_output_wallet& output) {
+    on_outputs_received(std::vector<std::shared_ptr<monero_output_wallet>>{ std::make_shared<monero_output_wallet>(output) });
+  }
+
+  void monero_async_listener::on_output_spent(const monero_output_wallet& output) {
+    on_outputs_spent(std::vector<std::shared_ptr<monero_output_wallet>>{ std::make_shared<monero_output_wallet>(output) });
+  }
+
+  void monero_async_listener::on_outputs_received(const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) {
+    event e = event();
+    e.m_type = OUTPUTS_RECEIVED;
+    e.m_outputs = outputs;
+    enqueue(e);
+  }
+
+  void monero_async_listener::on_outputs_spent(const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) {
+    event e = event();
+    e.m_type = OUTPUTS_SPENT;
+    e.m_outputs = outputs;
+    enqueue(e);
+  }
+
+  // ------------------------------- PRIVATE HELPERS ----------------------------
+
+  void monero_async_listener::enqueue(event& e) {
+    e.m_time = std::chrono::steady_clock::now();
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    if (m_queue.size() >= m_capacity) {
+      switch (m_policy) {
+        case DROP_OLDEST:
+          pop_front();
+          m_metrics.m_num_dropped++;
+          break;
+        case COALESCE:
+          if (coalesce(e)) {
+            m_metrics.m_num_coalesced++;
+            return;
+          }
+          // fall through to wait for room
+        case BLOCK:
+          m_metrics.m_num_blocked++;
+          while (m_queue.size() >= m_capacity && !m_is_stopping) m_not_full_cv.wait(lock);
+          break;
+      }
+    }
+    m_latest[e.m_type] = m_num_dequeued + m_queue.size() + 1;
+    m_queue.push_back(std::move(e));
+    m_metrics.m_max_depth = std::max(m_metrics.m_max_depth, (uint64_t) m_queue.size());
+    m_not_empty_cv.notify_one();
+  }
+
+  bool monero_async_listener::coalesce(event& e) {
+
+    // find the latest queued event of the same type
+    if (m_latest[e.m_type] <= m_num_dequeued) return false;
+    size_t idx = m_latest[e.m_type] - 1 - m_num_dequeued;
+    if (e.m_type == OUTPUTS_SPENT && idx != m_queue.size() - 1) return false; // spends only join the last event so they follow everything notified before them
+
+    // merge into it
+    event& latest = m_queue[idx];
+    if (e.m_type == OUTPUTS_RECEIVED || e.m_type == OUTPUTS_SPENT) {
+      latest.m_outputs.insert(latest.m_outputs.end(), e.m_outputs.begin(), e.m_outputs.end());
+    } else {
+      std::chrono::steady_clock::time_point time = latest.m_time;
+      latest = std::move(e);
+      latest.m_time = time;
+    }
+    return true;
+  }
+
+  void monero_async_listener::pop_front() {
+    m_queue.pop_front();
+    m_num_dequeued++;
+  }
+
+  void monero_async_listener::run_delivery() {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (true) {
+      if (m_queue.empty()) {
+        if (m_is_stopping) return;
+        m_not_empty_cv.wait(lock);
+        continue;
+      }
+      event e = std::move(m_queue.front());
+      pop_front();
+      m_not_full_cv.notify_one();
+
+      // deliver outside the lock
+      lock.unlock();
+      try {
+        deliver(e);
+      } catch (std::exception& ex) {
+        MERROR("Listener failed to process notification: " << ex.what());
+      }
+      e.m_outputs.clear(); // release output graphs before waiting
+      lock.lock();
+      m_metrics.m_num_delivered++;
+    }
+  }
+
+  void monero_async_listener::deliver(const event& e) {
+    switch (e.m_type) {
+      case SYNC_PROGRESS:
+        m_listener.on_sync_progress(e.m_height, e.m_start_height, e.m_end_height, e.m_percent_done, e.m_message);
+        break;
+      case NEW_BLOCK:
+        m_listener.on_new_block(e.m_height);
+        break;
+      case BALANCES_CHANGED:
+        m_listener.on_balances_changed(e.m_balance, e.m_unlocked_balance);
+        break;
+      case OUTPUTS_RECEIVED:
+        m_listener.on_outputs_received(e.m_outputs);
+        break;
+      case OUTPUTS_SPENT:
+        m_listener.on_outputs_spent(e.m_outputs);
+        break;
+    }
+  }
+}
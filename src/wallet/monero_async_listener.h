@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include "monero_wallet.h"
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <chrono>
+#include <deque>
+
+/**
+ * Asynchronous delivery of wallet notifications.
+ */
+namespace monero {
+
+  /**
+   * Wallet listener which queues notifications and delivers them to another listener
+   * on a dedicated thread, so a slow listener does not stall the thread which syncs
+   * the wallet.
+   *
+   * The queue is bounded.  When it is full, the backpressure policy decides whether
+   * the notifying thread waits for room, the oldest notification is dropped, or the
+   * notification is coalesced per kind: sync progress, new block, and balance
+   * notifications overwrite the latest queued notification of their kind, which keeps
+   * only the latest value, received outputs are appended to the latest queued batch of
+   * received outputs, and spent outputs are appended to the last queued notification
+   * if it is a batch of spent outputs, so a spend is never delivered before an earlier
+   * notification.  Coalescing waits for room otherwise.  Wallets
+   * notify without holding the locks their queries take, so the listener may query the
+   * wallet while the notifying thread waits.
+   *
+   * Outputs are delivered through on_outputs_received() and on_outputs_spent() with
+   * the tx and block graphs the wallet notified them with, which stay alive while
+   * queued.
+   *
+   * Usage: monero_async_listener async_listener(listener); wallet->add_listener(async_listener);
+   */
+  class monero_async_listener : public monero_wallet_listener {
+
+  public:
+
+    enum backpressure_policy : uint8_t {
+      BLOCK = 0,
+      DROP_OLDEST,
+      COALESCE
+    };
+
+    /**
+     * Queue metrics.
+     */
+    struct metrics {
+      uint64_t m_depth;           // number of queued notifications
+      uint64_t m_max_depth;       // maximum number of queued notifications
+      uint64_t m_num_delivered;   // number of notifications delivered
+      uint64_t m_num_dropped;     // number of notifications dropped by DROP_OLDEST
+      uint64_t m_num_coalesced;   // number of notifications coalesced by COALESCE
+      uint64_t m_num_blocked;     // number of notifications which waited for room
+      uint64_t m_lag_ms;          // age of the oldest queued notification in milliseconds
+    };
+
+    static const size_t DEFAULT_CAPACITY = 1024;
+
+    /**
+     * Start delivering notifications to a listener.
+     *
+     * @param listener is the listener to deliver notifications to
+     * @param capacity is the maximum number of queued notifications
+     * @param policy decides what happens to notifications while the queue is full
+     */
+    monero_async_listener(monero_wallet_listener& listener, size_t capacity = DEFAULT_CAPACITY, backpressure_policy policy = BLOCK);
+
+    /**
+     * Deliver queued notifications and stop the delivery thread.  Remove this listener
+     * from the wallet first.
+     */
+    ~monero_async_listener();
+
+    /**
+     * Get the queue metrics.
+     */
+    metrics get_metrics() const;
+
+    void on_sync_progress(uint64_t height, uint64_t start_height, uint64_t end_height, double percent_done, const std::string& message) override;
+    void on_new_block(uint64_t height) override;
+    void on_balances_changed(uint64_t new_balance, uint64_t new_unlocked_balance) override;
+    void on_output_received(const monero_output_wallet& output) override;
+    void on_output_spent(const monero_output_wallet& output) override;
+    void on_outputs_received(const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) override;
+    void on_outputs_spent(const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) override;
+
+    // --------------------------------- PRIVATE --------------------------------
+
+  private:
+
+    enum event_type : uint8_t { SYNC_PROGRESS, NEW_BLOCK, BALANCES_CHANGED, OUTPUTS_RECEIVED, OUTPUTS_SPENT, NUM_EVENT_TYPES };
+
+    struct event {
+      event_type m_type;
+      std::chrono::steady_clock::time_point m_time;  // when the first coalesced notification was queued
+      uint64_t m_height;
+      uint64_t m_start_height;
+      uint64_t m_end_height;
+      double m_percent_done;
+      std::string m_message;
+      uint64_t m_balance;
+      uint64_t m_unlocked_balance;
+      std::vector<std::shared_ptr<monero_output_wallet>> m_outputs;
+    };
+
+    monero_wallet_listener& m_listener;
+    const size_t m_capacity;
+    const backpressure_policy m_policy;
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_not_empty_cv;
+    boost::condition_variable m_not_full_cv;
+    std::deque<event> m_queue;
+    uint64_t m_num_dequeued;                     // number of events removed from the front of the queue
+    uint64_t m_latest[NUM_EVENT_TYPES];          // one past the sequence number of the latest queued event of each type, counted from the first event queued
+    metrics m_metrics;
+    bool m_is_stopping;
+    boost::thread m_delivery_thread;
+
+    void enqueue(event& e);
+    bool coalesce(event& e);  // caller holds m_mutex
+    void pop_front();         // caller holds m_mutex
+    void run_delivery();
+    void deliver(const event& e);
+  };
+}
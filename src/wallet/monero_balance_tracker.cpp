@@ -0,0 +1,291 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_balance_tracker.h"
+
+#include <ctime>
+
+/**
+ * Implements incremental tracking of a wallet's balances.
+ */
+namespace monero {
+
+  // ----------------------- INTERNAL PRIVATE HELPERS -----------------------
+
+  // first wallet height at which a transfer locked until a height passes wallet2::is_transfer_unlocked()
+  uint64_t get_unlock_height(const tools::wallet2::transfer_details& td) {
+    uint64_t unlock_height = td.m_block_height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE;
+    if (td.m_tx.unlock_time + 1 > CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS) unlock_height = std::max(unlock_height, td.m_tx.unlock_time + 1 - CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS);
+    return unlock_height;
+  }
+
+  // earliest local time at which a transfer locked until a timestamp may pass wallet2::is_transfer_unlocked(), which compares with the daemon's adjusted time
+  uint64_t get_unlock_timestamp(const tools::wallet2::transfer_details& td) {
+    uint64_t delta = std::max<uint64_t>(CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_SECONDS_V1, CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_SECONDS_V2);
+    return td.m_tx.unlock_time > delta ? td.m_tx.unlock_time - delta : 0;
+  }
+
+  // -------------------------- BALANCE TRACKER -------------------------------
+
+  monero_balance_tracker::monero_balance_tracker(tools::wallet2& w2) : m_w2(w2), m_is_initialized(false), m_height(0), m_time(0), m_last_block_height(0), m_is_unconfirmed_stale(true), m_total_unconfirmed_change(0) { }
+
+  void monero_balance_tracker::invalidate() {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    m_is_initialized = false;
+  }
+
+  bool monero_balance_tracker::on_new_block(uint64_t height) {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    if (m_is_initialized && height <= m_last_block_height) m_is_initialized = false; // reorg detached tracked transfers
+    m_last_block_height = height;
+    if (!m_is_initialized) return true;
+    if (!m_unlocks.empty() && m_unlocks.top().first <= height + 1) return true;
+    return !m_time_unlocks.empty() && m_time_unlocks.top().first <= (uint64_t) std::time(nullptr);
+  }
+
+  void monero_balance_tracker::mark_spent(const cryptonote::transaction& tx) {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    mark_inputs_dirty(tx);
+  }
+
+  void monero_balance_tracker::mark_unconfirmed_changed() {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    m_is_unconfirmed_stale = true;
+  }
+
+  uint64_t monero_balance_tracker::get_balance() {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    update();
+    return m_amounts.m_balance + m_total_unconfirmed_change;
+  }
+
+  uint64_t monero_balance_tracker::get_balance(uint32_t account_idx) {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    update();
+    auto iter = m_account_amounts.find(account_idx);
+    auto change_iter = m_unconfirmed_change.find(account_idx);
+    return (iter == m_account_amounts.end() ? 0 : iter->second.m_balance) + (change_iter == m_unconfirmed_change.end() ? 0 : change_iter->second);
+  }
+
+  uint64_t monero_balance_tracker::get_balance(uint32_t account_idx, uint32_t subaddress_idx) {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    update();
+    auto iter = m_subaddress_amounts.find(std::make_pair(account_idx, subaddress_idx));
+    auto change_iter = subaddress_idx == 0 ? m_unconfirmed_change.find(account_idx) : m_unconfirmed_change.end();
+    return (iter == m_subaddress_amounts.end() ? 0 : iter->second.m_balance) + (change_iter == m_unconfirmed_change.end() ? 0 : change_iter->second);
+  }
+
+  uint64_t monero_balance_tracker::get_unlocked_balance() {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    update();
+    return m_amounts.m_unlocked_balance;
+  }
+
+  uint64_t monero_balance_tracker::get_unlocked_balance(uint32_t account_idx) {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    update();
+    auto iter = m_account_amounts.find(account_idx);
+    return iter == m_account_amounts.end() ? 0 : iter->second.m_unlocked_balance;
+  }
+
+  uint64_t monero_balance_tracker::get_unlocked_balance(uint32_t account_idx, uint32_t subaddress_idx) {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    update();
+    auto iter = m_subaddress_amounts.find(std::make_pair(account_idx, subaddress_idx));
+    return iter == m_subaddress_amounts.end() ? 0 : iter->second.m_unlocked_balance;
+  }
+
+  void monero_balance_tracker::get_balances(std::map<std::pair<uint32_t, uint32_t>, std::pair<uint64_t, uint64_t>>& balances) {
+    boost::lock_guard<boost::mutex> guarg(m_mutex);
+    update();
+    for (const auto& entry : m_subaddress_amounts) {
+      if (entry.second.m_balance > 0) balances[entry.first] = std::make_pair(entry.second.m_balance, entry.second.m_unlocked_balance);
+    }
+    for (const auto& entry : m_unconfirmed_change) balances[std::make_pair(entry.first, (uint32_t) 0)].first += entry.second;
+  }
+
+  // ------------------------------- PRIVATE HELPERS ----------------------------
+
+  void monero_balance_tracker::update() {
+
+    // rebuild if transfers changed at untracked positions
+    bool is_rebuilt = !m_is_initialized || m_w2.get_num_transfer_details() < m_states.size();
+    if (is_rebuilt) {
+      clear();
+      m_is_initialized = true;
+      m_is_unconfirmed_stale = true;
+      m_last_block_height = m_w2.get_blockchain_current_height() - 1;
+    }
+    m_height = m_w2.get_blockchain_current_height();
+    m_time = std::time(nullptr);
+
+    // add appended transfers
+    for (size_t idx = m_states.size(); idx < m_w2.get_num_transfer_details(); idx++) {
+      m_states.push_back(UNCOUNTED);
+      evaluate(idx);
+    }
+
+    // re-read unconfirmed outgoing txs if changed
+    if (m_is_unconfirmed_stale) update_unconfirmed(is_rebuilt);
+
+    // re-evaluate spent transfers
+    for (size_t idx : m_dirty_transfers) evaluate(idx);
+    m_dirty_transfers.clear();
+
+    // re-evaluate locked transfers which are due to unlock
+    while (!m_unlocks.empty() && m_unlocks.top().first <= m_height) {
+      size_t idx = m_unlocks.top().second;
+      m_unlocks.pop();
+      if (m_states[idx] == LOCKED_BY_HEIGHT || m_states[idx] == LOCKED_BY_TIME) evaluate(idx, true);
+    }
+    while (!m_time_unlocks.empty() && m_time_unlocks.top().first <= m_time) {
+      size_t idx = m_time_unlocks.top().second;
+      m_time_unlocks.pop();
+      if (m_states[idx] == LOCKED_BY_TIME) evaluate(idx, true);
+    }
+  }
+
+  void monero_balance_tracker::update_unconfirmed(bool is_rebuilt) {
+
+    // collect change of unconfirmed outgoing txs, which wallet2 counts until they confirm or fail
+    std::list<std::pair<crypto::hash, tools::wallet2::unconfirmed_transfer_details>> unconfirmed_payments;
+    m_w2.get_unconfirmed_payments_out(unconfirmed_payments);
+    std::unordered_set<crypto::hash> failed_txs;
+    m_unconfirmed_change.clear();
+    m_total_unconfirmed_change = 0;
+    for (const auto& payment : unconfirmed_payments) {
+      if (payment.second.m_state == tools::wallet2::unconfirmed_transfer_details::failed) {
+        failed_txs.insert(payment.first);
+        if (!is_rebuilt && m_failed_txs.find(payment.first) == m_failed_txs.end()) mark_inputs_dirty(payment.second.m_tx); // wallet2 unspent its inputs
+        continue;
+      }
+      m_unconfirmed_change[payment.second.m_subaddr_account] += payment.second.m_change;
+      m_total_unconfirmed_change += payment.second.m_change;
+    }
+    m_failed_txs.swap(failed_txs);
+    m_is_unconfirmed_stale = false;
+  }
+
+  void monero_balance_tracker::mark_inputs_dirty(const cryptonote::transaction& tx) {
+    for (const cryptonote::txin_v& in : tx.vin) {
+      if (in.type() != typeid(cryptonote::txin_to_key)) continue;
+      auto iter = m_transfers_by_key_image.find(boost::get<cryptonote::txin_to_key>(in).k_image);
+      if (iter != m_transfers_by_key_image.end()) m_dirty_transfers.insert(iter->second);
+    }
+  }
+
+  void monero_balance_tracker::clear() {
+    m_states.clear();
+    m_transfers_by_key_image.clear();
+    m_dirty_transfers.clear();
+    m_unlocks = unlock_queue();
+    m_time_unlocks = unlock_queue();
+    m_subaddress_amounts.clear();
+    m_account_amounts.clear();
+    m_amounts = amounts();
+  }
+
+  void monero_balance_tracker::evaluate(size_t idx, bool is_due) {
+    const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(idx);
+    if (td.m_key_image_known) m_transfers_by_key_image[td.m_key_image] = idx;
+
+    // classify transfer like wallet2's non-strict balances
+    transfer_state state = UNCOUNTED;
+    if (!td.m_spent && !td.m_frozen) {
+      if (m_w2.is_transfer_unlocked(td)) state = UNLOCKED;
+      else if (td.m_tx.unlock_time < CRYPTONOTE_MAX_BLOCK_NUMBER) state = LOCKED_BY_HEIGHT;
+      else state = LOCKED_BY_TIME;
+    }
+
+    // move amount between balances
+    transfer_state prev_state = m_states[idx];
+    if (state != prev_state) {
+      count(td, prev_state, false);
+      count(td, state, true);
+      m_states[idx] = state;
+    }
+
+    // schedule unlock if newly locked or if a due transfer is still locked
+    if ((state == LOCKED_BY_HEIGHT || state == LOCKED_BY_TIME) && (state != prev_state || is_due)) schedule_unlock(td, idx, state);
+  }
+
+  void monero_balance_tracker::schedule_unlock(const tools::wallet2::transfer_details& td, size_t idx, transfer_state state) {
+
+    // transfers locked until a timestamp are first scheduled by height until old enough to spend
+    uint64_t spendable_height = td.m_block_height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE;
+    if (state == LOCKED_BY_HEIGHT || spendable_height > m_height) {
+      uint64_t unlock_height = state == LOCKED_BY_HEIGHT ? get_unlock_height(td) : spendable_height;
+      m_unlocks.push(std::make_pair(std::max(unlock_height, m_height + 1), idx));
+      return;
+    }
+
+    // re-check once per target block time if the daemon's time lags the local time
+    uint64_t unlock_timestamp = get_unlock_timestamp(td);
+    m_time_unlocks.push(std::make_pair(unlock_timestamp > m_time ? unlock_timestamp : m_time + DIFFICULTY_TARGET_V2, idx));
+  }
+
+  void monero_balance_tracker::count(const tools::wallet2::transfer_details& td, transfer_state state, bool add) {
+    if (state == UNCOUNTED) return;
+    uint64_t amount = td.amount();
+    uint64_t unlocked_amount = state == UNLOCKED ? amount : 0;
+    amounts* counted[] = { &m_subaddress_amounts[std::make_pair(td.m_subaddr_index.major, td.m_subaddr_index.minor)], &m_account_amounts[td.m_subaddr_index.major], &m_amounts };
+    for (amounts* a : counted) {
+      if (add) {
+        a->m_balance += amount;
+        a->m_unlocked_balance += unlocked_amount;
+      } else {
+        a->m_balance -= amount;
+        a->m_unlocked_balance -= unlocked_amount;
+      }
+    }
+  }
+}
@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include "wallet/wallet2.h"
+
+#include <boost/thread/mutex.hpp>
+#include <queue>
+#include <unordered_set>
+
+/**
+ * Incremental tracking of a wallet's balances.
+ */
+namespace monero {
+
+  /**
+   * Wallet-resident balances per account and subaddress, matching the non-strict
+   * wallet2::balance_per_subaddress() and wallet2::unlocked_balance_per_subaddress().
+   *
+   * Transfers appended by wallet2 are added as they arrive, spent transfers are
+   * re-evaluated by the key images of the txs which spend them, and locked transfers
+   * are scheduled by the height or timestamp at which they unlock, so reads do not walk
+   * every transfer in the wallet and only transfers which are due are re-evaluated.  The balances are rebuilt after a reorg
+   * or after changes which touch transfers at arbitrary positions (e.g. a rescan or
+   * import), which must call invalidate().
+   */
+  class monero_balance_tracker {
+
+  public:
+
+    /**
+     * Construct a tracker over the given wallet.
+     *
+     * @param w2 is the wallet whose balances are tracked
+     */
+    monero_balance_tracker(tools::wallet2& w2);
+
+    /**
+     * Discard tracked balances so they are rebuilt on next use.
+     */
+    void invalidate();
+
+    /**
+     * Record that wallet2 processed a block, which rebuilds the balances if the block
+     * replaces a tracked block.
+     *
+     * @param height is the height of the processed block
+     * @return true if the block may change the unlocked balance because scheduled transfers are due to unlock or the balances are rebuilt, false otherwise
+     */
+    bool on_new_block(uint64_t height);
+
+    /**
+     * Record that a tx spends wallet outputs so their transfers are re-evaluated.
+     *
+     * @param tx is the spending tx whose inputs' key images identify the spent transfers
+     */
+    void mark_spent(const cryptonote::transaction& tx);
+
+    /**
+     * Record that wallet2's unconfirmed outgoing txs may have changed (e.g. a tx was
+     * committed, confirmed, or failed), so they are re-read on next use.  Transfers
+     * spent by newly failed txs, which wallet2 unspends, are re-evaluated.
+     */
+    void mark_unconfirmed_changed();
+
+    /**
+     * Get balances, updating the tracker first if necessary.
+     */
+    uint64_t get_balance();
+    uint64_t get_balance(uint32_t account_idx);
+    uint64_t get_balance(uint32_t account_idx, uint32_t subaddress_idx);
+    uint64_t get_unlocked_balance();
+    uint64_t get_unlocked_balance(uint32_t account_idx);
+    uint64_t get_unlocked_balance(uint32_t account_idx, uint32_t subaddress_idx);
+
+    /**
+     * Get the balance and unlocked balance of every subaddress with a balance, updating
+     * the tracker first if necessary.
+     *
+     * @param balances are populated with balance and unlocked balance by account and subaddress index
+     */
+    void get_balances(std::map<std::pair<uint32_t, uint32_t>, std::pair<uint64_t, uint64_t>>& balances);
+
+    // --------------------------------- PRIVATE --------------------------------
+
+  private:
+
+    enum transfer_state : uint8_t { UNCOUNTED, UNLOCKED, LOCKED_BY_HEIGHT, LOCKED_BY_TIME };
+
+    struct amounts {
+      uint64_t m_balance;
+      uint64_t m_unlocked_balance;
+      amounts() : m_balance(0), m_unlocked_balance(0) {}
+    };
+
+    typedef std::pair<uint64_t, size_t> unlock_entry;  // unlock height or timestamp and transfer index
+    typedef std::priority_queue<unlock_entry, std::vector<unlock_entry>, std::greater<unlock_entry>> unlock_queue;
+
+    tools::wallet2& m_w2;                            // wallet whose balances are tracked
+    boost::mutex m_mutex;                            // synchronize updates and reads
+    bool m_is_initialized;                           // whether or not the balances are built
+    uint64_t m_height;                               // wallet height when last updated
+    uint64_t m_time;                                 // seconds since epoch when last updated
+    uint64_t m_last_block_height;                    // height of the last processed block
+    bool m_is_unconfirmed_stale;                     // whether unconfirmed outgoing txs changed since last read
+    std::unordered_set<crypto::hash> m_failed_txs;   // failed unconfirmed txs when last read, whose inputs wallet2 unspent
+    std::vector<transfer_state> m_states;            // how each tracked transfer is counted
+    std::unordered_map<crypto::key_image, size_t> m_transfers_by_key_image;
+    std::set<size_t> m_dirty_transfers;              // transfers to re-evaluate
+    unlock_queue m_unlocks;                          // locked transfers by the wallet height at which they unlock
+    unlock_queue m_time_unlocks;                     // locked transfers by the earliest timestamp at which they unlock
+    std::map<std::pair<uint32_t, uint32_t>, amounts> m_subaddress_amounts;
+    std::map<uint32_t, amounts> m_account_amounts;
+    amounts m_amounts;
+    std::map<uint32_t, uint64_t> m_unconfirmed_change;  // change of unconfirmed outgoing txs by account, credited to subaddress 0
+    uint64_t m_total_unconfirmed_change;
+
+    void update();
+    void update_unconfirmed(bool is_rebuilt);
+    void mark_inputs_dirty(const cryptonote::transaction& tx);
+    void clear();
+    void evaluate(size_t idx, bool is_due = false);
+    void schedule_unlock(const tools::wallet2::transfer_details& td, size_t idx, transfer_state state);
+    void count(const tools::wallet2::transfer_details& td, transfer_state state, bool add);
+  };
+}
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_output_scanner.h"
+
+#include "cryptonote_config.h"
+#include "common/threadpool.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "rpc/core_rpc_server_commands_defs.h"
+#include "storages/portable_storage_template_helper.h"
+#include "ringct/rctOps.h"
+
+namespace monero {
+
+  /**
+   * Decode an owned output's amount, confirming it against the output's commitment
+   * if the tx hides amounts.
+   */
+  bool decode_output_amount(const cryptonote::transaction& tx, size_t output_idx, const crypto::key_derivation& derivation, hw::device& hwdev, uint64_t& amount) {
+    if (tx.version == 1 || tx.rct_signatures.type == rct::RCTTypeNull) {
+      amount = tx.vout[output_idx].amount;
+      return true;
+    }
+    if (output_idx >= tx.rct_signatures.ecdhInfo.size() || output_idx >= tx.rct_signatures.outPk.size()) return false;
+    crypto::secret_key scalar;
+    if (!hwdev.derivation_to_scalar(derivation, output_idx, scalar)) return false;
+    rct::ecdhTuple ecdh_info = tx.rct_signatures.ecdhInfo[output_idx];
+    bool is_short_amount = tx.rct_signatures.type == rct::RCTTypeBulletproof2;
+    #if defined(HF_VERSION_CLSAG)
+      is_short_amount = is_short_amount || tx.rct_signatures.type == rct::RCTTypeCLSAG; // CLSAG ships with monero v0.17
+    #endif
+    if (!hwdev.ecdhDecode(ecdh_info, rct::sk2rct(scalar), is_short_amount)) return false;
+    amount = rct::h2d(ecdh_info.amount);
+    return rct::equalKeys(rct::commit(amount, ecdh_info.mask), tx.rct_signatures.outPk[output_idx].mask);
+  }
+
+  monero_output_scanner::monero_output_scanner(const std::vector<const monero_wallet_keys*>& wallets) : m_wallets(wallets) {
+    for (const monero_wallet_keys* wallet : m_wallets) {
+      if (wallet == nullptr) throw std::runtime_error("Wallet is null");
+      if (!wallet->m_subaddress_index.is_initialized()) throw std::runtime_error("Subaddress index is not built; call build_subaddress_index()");
+    }
+  }
+
+  std::vector<std::vector<std::shared_ptr<monero_output_wallet>>> monero_output_scanner::scan_blocks(const std::string& binary_blocks) const {
+
+    // load binary rpc response to struct
+    cryptonote::COMMAND_RPC_GET_BLOCKS_BY_HEIGHT::response resp_struct;
+    if (!epee::serialization::load_t_from_binary(resp_struct, binary_blocks)) throw std::runtime_error("Failed to parse binary blocks");
+
+    // scan blocks in parallel, collecting outputs per block to keep block order
+    std::vector<std::vector<std::vector<std::shared_ptr<monero_output_wallet>>>> block_outputs(resp_struct.blocks.size(), std::vector<std::vector<std::shared_ptr<monero_output_wallet>>>(m_wallets.size()));
+    auto scan_block = [&](size_t block_idx) {
+      cryptonote::block block;
+      if (!cryptonote::parse_and_validate_block_from_blob(resp_struct.blocks[block_idx].block, block)) {
+        throw std::runtime_error("failed to parse block blob at index " + std::to_string(block_idx));
+      }
+      uint64_t height = cryptonote::get_block_height(block);
+      scan_tx(block.miner_tx, height, block_outputs[block_idx]);
+      for (size_t tx_idx = 0; tx_idx < resp_struct.blocks[block_idx].txs.size(); tx_idx++) {
+        cryptonote::transaction tx;
+        if (!cryptonote::parse_and_validate_tx_from_blob(resp_struct.blocks[block_idx].txs[tx_idx].blob, tx)) {
+          throw std::runtime_error("failed to parse tx blob at index " + std::to_string(tx_idx));
+        }
+        scan_tx(tx, height, block_outputs[block_idx]);
+      }
+    };
+    tools::threadpool& tpool = tools::threadpool::getInstance();
+    tools::threadpool::waiter waiter(tpool);
+    for (size_t block_idx = 0; block_idx < resp_struct.blocks.size(); block_idx++) {
+      tpool.submit(&waiter, [&scan_block, block_idx]() { scan_block(block_idx); });
+    }
+    if (!waiter.wait()) throw std::runtime_error("Failed to scan blocks");
+
+    // concatenate outputs per wallet
+    std::vector<std::vector<std::shared_ptr<monero_output_wallet>>> outputs(m_wallets.size());
+    for (const std::vector<std::vector<std::shared_ptr<monero_output_wallet>>>& wallet_outputs : block_outputs) {
+      for (size_t wallet_idx = 0; wallet_idx < m_wallets.size(); wallet_idx++) {
+        outputs[wallet_idx].insert(outputs[wallet_idx].end(), wallet_outputs[wallet_idx].begin(), wallet_outputs[wallet_idx].end());
+      }
+    }
+    return outputs;
+  }
+
+  // ------------------------------- PRIVATE HELPERS ----------------------------
+
+  void monero_output_scanner::scan_tx(const cryptonote::transaction& tx, uint64_t height, std::vector<std::vector<std::shared_ptr<monero_output_wallet>>>& outputs) const {
+
+    // get tx public keys
+    crypto::public_key tx_pub_key = cryptonote::get_tx_pub_key_from_extra(tx);
+    std::vector<crypto::public_key> additional_tx_pub_keys = cryptonote::get_additional_tx_pub_keys_from_extra(tx);
+    if (additional_tx_pub_keys.size() != tx.vout.size()) additional_tx_pub_keys.clear();  // additional keys are only valid with one per output
+    if (tx_pub_key == crypto::null_pkey && additional_tx_pub_keys.empty()) return;
+
+    for (size_t wallet_idx = 0; wallet_idx < m_wallets.size(); wallet_idx++) {
+      const monero_wallet_keys& wallet = *m_wallets[wallet_idx];
+      const cryptonote::account_keys& keys = wallet.m_account.get_keys();
+      hw::device& hwdev = wallet.m_account.get_device();
+
+      // derive the tx's shared secrets once for all of its outputs
+      crypto::key_derivation derivation;
+      bool has_derivation = tx_pub_key != crypto::null_pkey && hwdev.generate_key_derivation(tx_pub_key, keys.m_view_secret_key, derivation);
+      std::vector<crypto::key_derivation> additional_derivations(additional_tx_pub_keys.size());
+      std::vector<bool> has_additional_derivations(additional_tx_pub_keys.size());
+      for (size_t i = 0; i < additional_tx_pub_keys.size(); i++) {
+        has_additional_derivations[i] = hwdev.generate_key_derivation(additional_tx_pub_keys[i], keys.m_view_secret_key, additional_derivations[i]);
+      }
+
+      // match each output's spend key against the subaddress index
+      std::shared_ptr<monero_tx_wallet> owned_tx;
+      for (size_t output_idx = 0; output_idx < tx.vout.size(); output_idx++) {
+        if (tx.vout[output_idx].target.type() != typeid(cryptonote::txout_to_key)) continue;
+        const crypto::public_key& output_key = boost::get<cryptonote::txout_to_key>(tx.vout[output_idx].target).key;
+        boost::optional<cryptonote::subaddress_index> index;
+        const crypto::key_derivation* matched_derivation = nullptr;
+        crypto::public_key spend_public_key;
+        if (has_derivation && hwdev.derive_subaddress_public_key(output_key, derivation, output_idx, spend_public_key)) {
+          index = wallet.m_subaddress_index.find(spend_public_key, keys, hwdev);
+          if (index) matched_derivation = &derivation;
+        }
+        if (!index && !additional_derivations.empty() && has_additional_derivations[output_idx] && hwdev.derive_subaddress_public_key(output_key, additional_derivations[output_idx], output_idx, spend_public_key)) {
+          index = wallet.m_subaddress_index.find(spend_public_key, keys, hwdev);
+          if (index) matched_derivation = &additional_derivations[output_idx];
+        }
+        if (!index) continue;
+        uint64_t amount;
+        if (!decode_output_amount(tx, output_idx, *matched_derivation, hwdev, amount)) continue;
+
+        // build tx on first owned output
+        if (owned_tx == nullptr) {
+          std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
+          block->m_height = height;
+          owned_tx = std::make_shared<monero_tx_wallet>();
+          owned_tx->m_block = block;
+          block->m_txs.push_back(owned_tx);
+          owned_tx->m_hash = monero_lazy_hex::from_pod(cryptonote::get_transaction_hash(tx));
+          owned_tx->m_is_miner_tx = !tx.vin.empty() && tx.vin[0].type() == typeid(cryptonote::txin_gen);
+          owned_tx->m_unlock_time = tx.unlock_time;
+          owned_tx->m_is_confirmed = true;
+          owned_tx->m_in_tx_pool = false;
+          owned_tx->m_is_incoming = true;
+        }
+
+        // build output
+        std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
+        output->m_tx = owned_tx;
+        owned_tx->m_outputs.push_back(output);
+        output->m_amount = amount;
+        output->m_account_index = index->major;
+        output->m_subaddress_index = index->minor;
+        output->m_stealth_public_key = monero_lazy_hex::from_pod(output_key);
+        outputs[wallet_idx].push_back(output);
+      }
+    }
+  }
+}
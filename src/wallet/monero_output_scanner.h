@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include "monero_wallet_keys.h"
+
+/**
+ * Output scanning for keys-only wallets.
+ */
+namespace monero {
+
+  /**
+   * Detects outputs received by one or more keys-only wallets in raw blocks.
+   *
+   * Scanning needs only each wallet's view secret key and subaddress index, so many
+   * wallets can be watched without a wallet2 cache per wallet.  Each tx's key
+   * derivations are computed once per wallet and shared by all of the tx's outputs,
+   * and blocks are scanned in parallel on the common thread pool.
+   */
+  class monero_output_scanner {
+
+  public:
+
+    /**
+     * Construct a scanner over the given wallets.
+     *
+     * @param wallets are the wallets to scan for, which must outlive the scanner and have built their subaddress index
+     */
+    monero_output_scanner(const std::vector<const monero_wallet_keys*>& wallets);
+
+    /**
+     * Scan blocks for outputs received by the wallets.
+     *
+     * Outputs are returned with their tx hash, block height, amount and subaddress.
+     * Global output indices and key images are not known from the blocks alone.
+     *
+     * @param binary_blocks is a binary get_blocks_by_height response, as decoded by monero_utils::binary_blocks_to_json()
+     * @return the outputs received by each wallet in block order, in the same order as the wallets
+     */
+    std::vector<std::vector<std::shared_ptr<monero_output_wallet>>> scan_blocks(const std::string& binary_blocks) const;
+
+  private:
+    std::vector<const monero_wallet_keys*> m_wallets;
+
+    void scan_tx(const cryptonote::transaction& tx, uint64_t height, std::vector<std::vector<std::shared_ptr<monero_output_wallet>>>& outputs) const;
+  };
+}
@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Arena to own the model objects of query results.
+ */
+namespace monero {
+
+  /**
+   * Owns every object of one or more query results and destroys them together.
+   *
+   * Objects are bump-allocated from large blocks instead of one heap allocation each, and
+   * are returned as shared pointers which do not own or count references to the object.
+   * The results must not be used after the arena is destroyed, and need not be freed with
+   * monero_utils::free() since references between objects cannot keep them alive.
+   *
+   * An arena is not thread-safe, so use one arena per query in progress.
+   */
+  class monero_result_arena {
+
+  public:
+
+    /**
+     * Construct an empty arena.
+     *
+     * @param block_size is the number of bytes to allocate at a time
+     */
+    explicit monero_result_arena(size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    /**
+     * Destroy every object in the arena in reverse order of construction.
+     */
+    ~monero_result_arena();
+
+    monero_result_arena(const monero_result_arena&) = delete;
+    monero_result_arena& operator=(const monero_result_arena&) = delete;
+
+    /**
+     * Construct an object in the arena.
+     *
+     * @param args are forwarded to the object's constructor
+     * @return a non-owning shared pointer to the object which is valid until the arena is destroyed
+     */
+    template <class T, class... Args>
+    std::shared_ptr<T> make(Args&&... args) {
+      T* obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      if (!std::is_trivially_destructible<T>::value) {
+        finalizer* fin = new (allocate(sizeof(finalizer), alignof(finalizer))) finalizer();
+        fin->m_destroy = [](void* ptr) { static_cast<T*>(ptr)->~T(); };
+        fin->m_obj = obj;
+        fin->m_next = m_finalizers;
+        m_finalizers = fin;
+      }
+      return std::shared_ptr<T>(std::shared_ptr<T>(), obj);
+    }
+
+    /**
+     * Get the number of bytes allocated by the arena.
+     */
+    size_t get_capacity() const { return m_capacity; }
+
+    // --------------------------------- PRIVATE --------------------------------
+
+  private:
+    static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    /**
+     * Destroys one object when the arena is destroyed.
+     */
+    struct finalizer {
+      void (*m_destroy)(void*);
+      void* m_obj;
+      finalizer* m_next;
+    };
+
+    size_t m_block_size;                             // number of bytes to allocate at a time
+    std::vector<std::unique_ptr<char[]>> m_blocks;   // allocated blocks
+    char* m_next;                                    // next free byte in the current block
+    size_t m_remaining;                              // free bytes in the current block
+    size_t m_capacity;                               // total bytes allocated
+    finalizer* m_finalizers;                         // objects to destroy, most recent first
+    void* allocate(size_t size, size_t alignment);
+  };
+}
@@ -0,0 +1,243 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_subaddress_index.h"
+
+#include "common/threadpool.h"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace monero {
+
+  const char FILE_MAGIC[8] = {'M', 'N', 'R', 'S', 'U', 'B', 'I', 'X'};
+  const uint32_t BUILD_BATCH_SIZE = 1 << 20;  // subaddresses derived before inserting into the table
+  const uint32_t BUILD_CHUNK_SIZE = 4096;     // subaddresses derived per thread pool task
+
+  monero_subaddress_index::monero_subaddress_index() : m_slots(nullptr), m_mask(0), m_num_accounts(0), m_num_subaddresses(0), m_spend_public_key(crypto::null_pkey) { }
+  monero_subaddress_index::monero_subaddress_index(monero_subaddress_index&& other) : monero_subaddress_index() {
+    *this = std::move(other);
+  }
+
+  monero_subaddress_index& monero_subaddress_index::operator=(monero_subaddress_index&& other) {
+    if (this == &other) return *this;
+    m_table = std::move(other.m_table);  // moving keeps the slots' buffer
+    m_region = std::move(other.m_region);
+    m_slots = other.m_slots;
+    m_mask = other.m_mask;
+    m_num_accounts = other.m_num_accounts;
+    m_num_subaddresses = other.m_num_subaddresses;
+    m_spend_public_key = other.m_spend_public_key;
+    other.clear();
+    return *this;
+  }
+
+  monero_subaddress_index::~monero_subaddress_index() { }
+
+  void monero_subaddress_index::build(const cryptonote::account_keys& keys, hw::device& hwdev, uint32_t num_accounts, uint32_t num_subaddresses) {
+    clear();
+    uint64_t num_entries = static_cast<uint64_t>(num_accounts) * num_subaddresses;
+    if (num_entries > std::numeric_limits<uint32_t>::max()) throw std::runtime_error("Too many subaddresses to index: " + std::to_string(num_entries));
+
+    // size the table for a load factor of at most 0.75
+    uint64_t capacity = get_capacity(num_entries);
+    m_table.assign(capacity, slot{0, EMPTY_SLOT, 0});
+    m_mask = capacity - 1;
+
+    // derive spend keys in batches spread over the thread pool, then insert them; hardware devices are not thread safe so derive serially
+    tools::threadpool& tpool = tools::threadpool::getInstance();
+    bool is_parallel = hwdev.get_type() == hw::device::device_type::SOFTWARE && tpool.get_max_concurrency() > 1;
+    std::vector<uint64_t> key_prefixes;
+    for (uint32_t account_idx = 0; account_idx < num_accounts; account_idx++) {
+      for (uint32_t batch_begin = 0; batch_begin < num_subaddresses; ) {
+        uint32_t batch_end = batch_begin + std::min(BUILD_BATCH_SIZE, num_subaddresses - batch_begin);
+        key_prefixes.resize(batch_end - batch_begin);
+        auto derive_chunk = [&](uint32_t chunk_begin, uint32_t chunk_end) {
+          std::vector<crypto::public_key> spend_public_keys = hwdev.get_subaddress_spend_public_keys(keys, account_idx, chunk_begin, chunk_end);
+          for (uint32_t i = 0; i < spend_public_keys.size(); i++) key_prefixes[chunk_begin - batch_begin + i] = get_key_prefix(spend_public_keys[i]);
+        };
+        if (!is_parallel) derive_chunk(batch_begin, batch_end);
+        else {
+          tools::threadpool::waiter waiter(tpool);
+          for (uint32_t chunk_begin = batch_begin; chunk_begin < batch_end; ) {
+            uint32_t chunk_end = chunk_begin + std::min(BUILD_CHUNK_SIZE, batch_end - chunk_begin);
+            tpool.submit(&waiter, [&derive_chunk, chunk_begin, chunk_end]() { derive_chunk(chunk_begin, chunk_end); });
+            chunk_begin = chunk_end;
+          }
+          if (!waiter.wait()) throw std::runtime_error("Failed to derive subaddress keys");
+        }
+        for (uint32_t i = 0; i < key_prefixes.size(); i++) insert(key_prefixes[i], account_idx, batch_begin + i);
+        batch_begin = batch_end;
+      }
+    }
+
+    m_num_accounts = num_accounts;
+    m_num_subaddresses = num_subaddresses;
+    m_spend_public_key = keys.m_account_address.m_spend_public_key;
+    m_slots = m_table.data();
+  }
+
+  boost::optional<cryptonote::subaddress_index> monero_subaddress_index::find(const cryptonote::account_public_address& address, const cryptonote::account_keys& keys, hw::device& hwdev) const {
+    boost::optional<cryptonote::subaddress_index> index = find(address.m_spend_public_key, keys, hwdev);
+    if (index && hwdev.get_subaddress(keys, *index).m_view_public_key != address.m_view_public_key) return boost::none;
+    return index;
+  }
+
+  boost::optional<cryptonote::subaddress_index> monero_subaddress_index::find(const crypto::public_key& spend_public_key, const cryptonote::account_keys& keys, hw::device& hwdev) const {
+    if (!is_initialized()) return boost::none;
+    uint64_t key_prefix = get_key_prefix(spend_public_key);
+
+    // probe at most every slot once in case a corrupt table has no empty slot
+    uint64_t pos = key_prefix & m_mask;
+    for (uint64_t num_probes = 0; num_probes <= m_mask && m_slots[pos].m_account_index != EMPTY_SLOT; num_probes++, pos = (pos + 1) & m_mask) {
+      if (m_slots[pos].m_key_prefix != key_prefix) continue;
+
+      // confirm the match since only a prefix of the key is stored
+      cryptonote::subaddress_index index{m_slots[pos].m_account_index, m_slots[pos].m_subaddress_index};
+      if (hwdev.get_subaddress_spend_public_key(keys, index) == spend_public_key) return index;
+    }
+    return boost::none;
+  }
+
+  void monero_subaddress_index::save(const std::string& path) const {
+    if (!is_initialized()) throw std::runtime_error("Subaddress index is not initialized");
+
+    // write to a temporary file and rename so a partial write never replaces a valid index
+    file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.m_version = FILE_VERSION;
+    header.m_num_accounts = m_num_accounts;
+    header.m_num_subaddresses = m_num_subaddresses;
+    header.m_capacity = m_mask + 1;
+    header.m_spend_public_key = m_spend_public_key;
+    std::string tmp_path = path + ".tmp";
+    {
+      std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(m_slots), sizeof(slot) * header.m_capacity);
+      if (!file) throw std::runtime_error("Failed to write subaddress index: " + tmp_path);
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) throw std::runtime_error("Failed to write subaddress index: " + path);
+  }
+
+  bool monero_subaddress_index::load(const std::string& path, const cryptonote::account_keys& keys, bool use_mmap) {
+    clear();
+
+    // read and validate header
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    uint64_t file_size = file.tellg();
+    file_header header;
+    if (file_size < sizeof(header)) return false;
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || memcmp(header.m_magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.m_version != FILE_VERSION) return false;
+    if (header.m_spend_public_key != keys.m_account_address.m_spend_public_key) return false;
+    if (header.m_capacity != get_capacity(static_cast<uint64_t>(header.m_num_accounts) * header.m_num_subaddresses)) return false;
+    if (file_size != sizeof(header) + sizeof(slot) * header.m_capacity) return false;
+
+    // map or read slots
+    if (use_mmap) {
+      file.close();
+      boost::interprocess::file_mapping mapping(path.c_str(), boost::interprocess::read_only);
+      m_region.reset(new boost::interprocess::mapped_region(mapping, boost::interprocess::read_only, sizeof(header), sizeof(slot) * header.m_capacity));
+      m_slots = static_cast<const slot*>(m_region->get_address());
+    } else {
+      m_table.resize(header.m_capacity);
+      file.read(reinterpret_cast<char*>(m_table.data()), sizeof(slot) * header.m_capacity);
+      if (!file) {
+        clear();
+        return false;
+      }
+      m_slots = m_table.data();
+    }
+    m_mask = header.m_capacity - 1;
+    m_num_accounts = header.m_num_accounts;
+    m_num_subaddresses = header.m_num_subaddresses;
+    m_spend_public_key = header.m_spend_public_key;
+    return true;
+  }
+
+  void monero_subaddress_index::clear() {
+    m_slots = nullptr;
+    m_region.reset();
+    std::vector<slot>().swap(m_table);
+    m_mask = 0;
+    m_num_accounts = 0;
+    m_num_subaddresses = 0;
+    m_spend_public_key = crypto::null_pkey;
+  }
+
+  // ------------------------------- PRIVATE HELPERS ----------------------------
+
+  uint64_t monero_subaddress_index::get_key_prefix(const crypto::public_key& key) {
+    uint64_t key_prefix;
+    memcpy(&key_prefix, key.data, sizeof(key_prefix));
+    return key_prefix;
+  }
+
+  uint64_t monero_subaddress_index::get_capacity(uint64_t num_entries) {
+    uint64_t capacity = 16;
+    while (capacity < num_entries + num_entries / 3) capacity <<= 1;
+    return capacity;
+  }
+
+  void monero_subaddress_index::insert(uint64_t key_prefix, uint32_t account_idx, uint32_t subaddress_idx) {
+    uint64_t pos = key_prefix & m_mask;
+    while (m_table[pos].m_account_index != EMPTY_SLOT) pos = (pos + 1) & m_mask;
+    m_table[pos] = slot{key_prefix, account_idx, subaddress_idx};
+  }
+}
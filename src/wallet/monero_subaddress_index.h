@@ -0,0 +1,200 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include "cryptonote_basic/cryptonote_basic.h"
+#include "cryptonote_basic/subaddress_index.h"
+#include "device/device.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace boost { namespace interprocess { class mapped_region; } }
+
+/**
+ * Reverse lookup from subaddresses to their indices.
+ */
+namespace monero {
+
+  /**
+   * Compact index from subaddress spend public keys to subaddress indices.
+   *
+   * Each subaddress takes one 16 byte slot holding the first 8 bytes of its spend
+   * public key and its indices in an open addressing table with a power of 2 capacity
+   * and a load factor of at most 0.75, so 10M subaddresses take 2^24 slots (256 MiB).
+   * Lookups re-derive the matched subaddress to confirm it, so a
+   * prefix collision never attributes an address to the wrong subaddress.
+   *
+   * The table can be saved to a file and memory mapped when loaded, so a large index
+   * is built once and then opened without reading it into memory.
+   */
+  class monero_subaddress_index {
+
+  public:
+
+    /**
+     * Get the path of the index persisted alongside a wallet.
+     *
+     * @param wallet_path is the path of the wallet
+     * @return the path of the wallet's subaddress index
+     */
+    static std::string get_path(const std::string& wallet_path) { return wallet_path + ".subaddresses"; }
+
+    monero_subaddress_index();
+    monero_subaddress_index(monero_subaddress_index&& other);
+    monero_subaddress_index& operator=(monero_subaddress_index&& other);
+    ~monero_subaddress_index();
+
+    /**
+     * Indicates if the index has been built or loaded.
+     */
+    bool is_initialized() const { return m_slots != nullptr; }
+
+    /**
+     * Get the number of accounts indexed.
+     */
+    uint32_t get_num_accounts() const { return m_num_accounts; }
+
+    /**
+     * Get the number of subaddresses indexed per account.
+     */
+    uint32_t get_num_subaddresses() const { return m_num_subaddresses; }
+
+    /**
+     * Index every subaddress in a range of accounts, deriving keys on the common thread pool.
+     *
+     * @param keys are the keys of the wallet to index
+     * @param hwdev is the device to derive subaddress keys with
+     * @param num_accounts is the number of accounts to index, starting from account 0
+     * @param num_subaddresses is the number of subaddresses to index per account, starting from subaddress 0
+     */
+    void build(const cryptonote::account_keys& keys, hw::device& hwdev, uint32_t num_accounts, uint32_t num_subaddresses);
+
+    /**
+     * Look up the indices of a wallet subaddress.
+     *
+     * @param address is the subaddress to look up
+     * @param keys are the keys of the indexed wallet
+     * @param hwdev is the device to confirm the matched subaddress with
+     * @return the indices of the subaddress or none if it is not indexed
+     */
+    boost::optional<cryptonote::subaddress_index> find(const cryptonote::account_public_address& address, const cryptonote::account_keys& keys, hw::device& hwdev) const;
+
+    /**
+     * Look up the indices of a wallet subaddress by its spend public key, e.g. as derived
+     * from an output while scanning.
+     *
+     * @param spend_public_key is the spend public key of the subaddress to look up
+     * @param keys are the keys of the indexed wallet
+     * @param hwdev is the device to confirm the matched subaddress with
+     * @return the indices of the subaddress or none if it is not indexed
+     */
+    boost::optional<cryptonote::subaddress_index> find(const crypto::public_key& spend_public_key, const cryptonote::account_keys& keys, hw::device& hwdev) const;
+
+    /**
+     * Save the index to a file.
+     *
+     * @param path is the path of the file to write
+     */
+    void save(const std::string& path) const;
+
+    /**
+     * Load an index saved for the given wallet keys.
+     *
+     * @param path is the path of the file to read
+     * @param keys are the keys of the wallet the index must belong to
+     * @param use_mmap specifies if the file is memory mapped instead of read into memory
+     * @return true if the index was loaded, false if the file does not exist, is malformed, or belongs to another wallet
+     */
+    bool load(const std::string& path, const cryptonote::account_keys& keys, bool use_mmap = true);
+
+    /**
+     * Discard the index.
+     */
+    void clear();
+
+  private:
+
+    struct slot {
+      uint64_t m_key_prefix;        // first 8 bytes of the subaddress spend public key
+      uint32_t m_account_index;     // EMPTY_SLOT if the slot is unused
+      uint32_t m_subaddress_index;
+    };
+
+    struct file_header {
+      char m_magic[8];
+      uint32_t m_version;
+      uint32_t m_num_accounts;
+      uint32_t m_num_subaddresses;
+      uint32_t m_reserved;
+      uint64_t m_capacity;
+      crypto::public_key m_spend_public_key;
+    };
+
+    static const uint32_t EMPTY_SLOT = 0xffffffff;
+    static const uint32_t FILE_VERSION = 1;
+
+    std::vector<slot> m_table;                                 // slots when built or read into memory
+    std::unique_ptr<boost::interprocess::mapped_region> m_region;  // slots when memory mapped
+    const slot* m_slots;
+    uint64_t m_mask;
+    uint32_t m_num_accounts;
+    uint32_t m_num_subaddresses;
+    crypto::public_key m_spend_public_key;
+
+    static uint64_t get_key_prefix(const crypto::public_key& key);
+    static uint64_t get_capacity(uint64_t num_entries);
+    void insert(uint64_t key_prefix, uint32_t account_idx, uint32_t subaddress_idx);
+  };
+}
@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_sync_scheduler.h"
+
+#include "misc_log_ex.h"
+
+namespace monero {
+
+  const uint64_t monero_sync_scheduler::STOP;
+  const uint32_t monero_sync_scheduler::DEFAULT_NUM_WORKERS;
+  static thread_local std::pair<const monero_sync_scheduler*, uint64_t> t_running_task(nullptr, 0); // scheduler and id of the task this worker runs
+
+  monero_sync_scheduler& monero_sync_scheduler::get_instance() {
+    static monero_sync_scheduler instance;
+    return instance;
+  }
+
+  monero_sync_scheduler& monero_sync_scheduler::get_async_instance() {
+    static monero_sync_scheduler instance;
+    return instance;
+  }
+
+  monero_sync_scheduler::monero_sync_scheduler() : m_next_id(1), m_is_stopping(false) {
+    set_num_workers(DEFAULT_NUM_WORKERS);
+  }
+
+  monero_sync_scheduler::~monero_sync_scheduler() {
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_is_stopping = true;
+    }
+    m_queue_cv.notify_all();
+    for (boost::thread& worker : m_workers) worker.join();
+  }
+
+  void monero_sync_scheduler::set_num_workers(uint32_t num_workers) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    while (m_workers.size() < num_workers) m_workers.push_back(boost::thread([this]() { run_worker(); }));
+  }
+
+  uint64_t monero_sync_scheduler::add(const task& fn) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    uint64_t id = m_next_id++;
+    entry& e = m_entries[id];
+    e.m_task = fn;
+    e.m_is_running = false;
+    e.m_is_woken = false;
+    e.m_is_removed = false;
+    enqueue(id, e, std::chrono::steady_clock::now());
+    return id;
+  }
+
+  void monero_sync_scheduler::wake(uint64_t id) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    auto iter = m_entries.find(id);
+    if (iter == m_entries.end() || iter->second.m_is_removed) return;
+    entry& e = iter->second;
+    if (e.m_is_running) e.m_is_woken = true;
+    else {
+      m_queue.erase(std::make_pair(e.m_due, id));
+      enqueue(id, e, std::chrono::steady_clock::now());
+    }
+  }
+
+  void monero_sync_scheduler::remove(uint64_t id) {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    auto iter = m_entries.find(id);
+    if (iter == m_entries.end()) return;
+    if (!iter->second.m_is_running) {
+      m_queue.erase(std::make_pair(iter->second.m_due, id));
+      m_entries.erase(iter);
+      return;
+    }
+    iter->second.m_is_removed = true;
+    if (t_running_task == std::make_pair((const monero_sync_scheduler*) this, id)) return; // erased by this worker once the step returns
+    while (m_entries.find(id) != m_entries.end()) m_done_cv.wait(lock);
+  }
+
+  // ------------------------------- PRIVATE HELPERS ----------------------------
+
+  void monero_sync_scheduler::enqueue(uint64_t id, entry& e, time_point due) {
+    e.m_due = due;
+    m_queue.insert(std::make_pair(due, id));
+    m_queue_cv.notify_one();
+  }
+
+  void monero_sync_scheduler::run_worker() {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (!m_is_stopping) {
+
+      // wait for the next due task
+      if (m_queue.empty()) {
+        m_queue_cv.wait(lock);
+        continue;
+      }
+      time_point now = std::chrono::steady_clock::now();
+      if (m_queue.begin()->first > now) {
+        m_queue_cv.wait_for(lock, boost::chrono::milliseconds(std::chrono::duration_cast<std::chrono::milliseconds>(m_queue.begin()->first - now).count() + 1));
+        continue;
+      }
+      uint64_t id = m_queue.begin()->second;
+      m_queue.erase(m_queue.begin());
+      entry& e = m_entries[id];
+      e.m_is_running = true;
+      task fn = e.m_task;
+
+      // run one step outside the lock
+      lock.unlock();
+      uint64_t delay_ms = STOP;
+      t_running_task = std::make_pair(this, id);
+      try {
+        delay_ms = fn();
+      } catch (std::exception& ex) {
+        MERROR("Sync task " << id << " failed: " << ex.what());
+      }
+      t_running_task = std::make_pair(nullptr, 0);
+      lock.lock();
+
+      // reschedule unless stopped or removed
+      entry& done = m_entries[id];
+      done.m_is_running = false;
+      if (done.m_is_removed || delay_ms == STOP) {
+        m_entries.erase(id);
+        m_done_cv.notify_all();
+      } else {
+        enqueue(id, done, done.m_is_woken ? std::chrono::steady_clock::now() : std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms));
+        done.m_is_woken = false;
+      }
+    }
+  }
+}
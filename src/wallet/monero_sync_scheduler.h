@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+/**
+ * Process-wide scheduling of background wallet syncs.
+ */
+namespace monero {
+
+  /**
+   * Runs the background sync loops of every wallet in the process on one bounded pool
+   * of worker threads.
+   *
+   * Each wallet registers a task which performs one sync step and returns how long to
+   * wait before its next step, so thousands of wallets share a few threads instead of
+   * each holding a thread that mostly sleeps.  A task runs on at most one worker at a
+   * time, so steps are kept short: a wallet syncing a long range of blocks refreshes for
+   * a bounded time per step and returns 0 to continue behind other due tasks.  One-off
+   * wallet operations such as sync_async() and create_txs_async() run on a separate
+   * instance so they never wait behind sync loops; sync_async() likewise syncs in
+   * bounded steps, and other operations return STOP after their only step.
+   */
+  class monero_sync_scheduler {
+
+  public:
+
+    typedef std::function<uint64_t()> task;          // runs one step and returns milliseconds until the next step or STOP
+    static const uint64_t STOP = (uint64_t) -1;      // returned by a task to unschedule itself
+    static const uint32_t DEFAULT_NUM_WORKERS = 4;
+
+    /**
+     * Get the scheduler of background sync loops shared by the process.
+     */
+    static monero_sync_scheduler& get_instance();
+
+    /**
+     * Get the scheduler of one-off async wallet operations shared by the process.
+     */
+    static monero_sync_scheduler& get_async_instance();
+
+    ~monero_sync_scheduler();
+
+    /**
+     * Raise the number of worker threads.  The pool only grows.
+     *
+     * @param num_workers is the number of workers to run tasks on
+     */
+    void set_num_workers(uint32_t num_workers);
+
+    /**
+     * Schedule a task to run as soon as a worker is free.
+     *
+     * @param fn runs one step of the task
+     * @return the id of the scheduled task
+     */
+    uint64_t add(const task& fn);
+
+    /**
+     * Run a task as soon as a worker is free, or again right after its current step.
+     *
+     * @param id is the id of the task to wake
+     */
+    void wake(uint64_t id);
+
+    /**
+     * Unschedule a task, waiting for its current step to finish.  If called from the
+     * task's own step, the task is unscheduled once the step returns without waiting.
+     *
+     * @param id is the id of the task to unschedule
+     */
+    void remove(uint64_t id);
+
+  private:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    struct entry {
+      task m_task;
+      time_point m_due;
+      bool m_is_running;
+      bool m_is_woken;    // run again right after the current step
+      bool m_is_removed;  // erase once the current step finishes
+    };
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_queue_cv;  // signals workers that the queue changed
+    boost::condition_variable m_done_cv;   // signals removers that a task's step finished
+    std::map<uint64_t, entry> m_entries;
+    std::set<std::pair<time_point, uint64_t>> m_queue;  // tasks waiting to run by due time
+    std::vector<boost::thread> m_workers;
+    uint64_t m_next_id;
+    bool m_is_stopping;
+
+    monero_sync_scheduler();
+    void run_worker();
+    void enqueue(uint64_t id, entry& e, time_point due);
+  };
+}
@@ -0,0 +1,300 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_tx_index.h"
+
+/**
+ * Implements an index of a wallet's confirmed transaction history.
+ */
+namespace monero {
+
+  // ----------------------- INTERNAL PRIVATE HELPERS -----------------------
+
+  uint64_t get_indexed_height(const tools::wallet2::payment_details& pd) {
+    return pd.m_block_height;
+  }
+
+  uint64_t get_indexed_height(const tools::wallet2::confirmed_transfer_details& ctd) {
+    return ctd.m_block_height;
+  }
+
+  const crypto::hash& get_indexed_tx_hash(const std::pair<crypto::hash, tools::wallet2::payment_details>& payment) {
+    return payment.second.m_tx_hash;
+  }
+
+  const crypto::hash& get_indexed_tx_hash(const std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>& payment) {
+    return payment.first;
+  }
+
+  const crypto::hash& get_indexed_payment_id(const std::pair<crypto::hash, tools::wallet2::payment_details>& payment) {
+    return payment.first;
+  }
+
+  const crypto::hash& get_indexed_payment_id(const std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>& payment) {
+    return payment.second.m_payment_id;
+  }
+
+  uint32_t get_indexed_account(const std::pair<crypto::hash, tools::wallet2::payment_details>& payment) {
+    return payment.second.m_subaddr_index.major;
+  }
+
+  uint32_t get_indexed_account(const std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>& payment) {
+    return payment.second.m_subaddr_account;
+  }
+
+  // matches wallet2::get_payments() subaddress filtering
+  bool has_indexed_subaddress(const std::pair<crypto::hash, tools::wallet2::payment_details>& payment, const std::set<uint32_t>& subaddress_indices) {
+    return subaddress_indices.empty() || subaddress_indices.count(payment.second.m_subaddr_index.minor) == 1;
+  }
+
+  // matches wallet2::get_payments_out() subaddress filtering
+  bool has_indexed_subaddress(const std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>& payment, const std::set<uint32_t>& subaddress_indices) {
+    if (subaddress_indices.empty()) return true;
+    for (uint32_t subaddress_idx : payment.second.m_subaddr_indices) {
+      if (subaddress_indices.count(subaddress_idx) == 1) return true;
+    }
+    return false;
+  }
+
+  template <class T>
+  bool meets_index_query(const std::pair<crypto::hash, T>& payment, const monero_tx_index_query& query) {
+    if (query.m_account_index != boost::none && *query.m_account_index != get_indexed_account(payment)) return false;
+    if (!has_indexed_subaddress(payment, query.m_subaddress_indices)) return false;
+    if (query.m_tx_hashes != boost::none && query.m_tx_hashes->count(get_indexed_tx_hash(payment)) == 0) return false;
+    if (query.m_payment_ids != boost::none && query.m_payment_ids->count(get_indexed_payment_id(payment)) == 0) return false;
+    return true;
+  }
+
+  template <class K>
+  void add_indexed_height(std::unordered_map<K, std::set<uint64_t>>& heights_by_key, const K& key, uint64_t height) {
+    heights_by_key[key].insert(height);
+  }
+
+  template <class K>
+  void erase_indexed_height(std::unordered_map<K, std::set<uint64_t>>& heights_by_key, const K& key, uint64_t height) {
+    auto iter = heights_by_key.find(key);
+    if (iter == heights_by_key.end()) return;
+    iter->second.erase(height);
+    if (iter->second.empty()) heights_by_key.erase(iter);
+  }
+
+  template <class K>
+  void collect_indexed_heights(const std::unordered_map<K, std::set<uint64_t>>& heights_by_key, const K& key, std::set<uint64_t>& heights) {
+    auto iter = heights_by_key.find(key);
+    if (iter != heights_by_key.end()) heights.insert(iter->second.begin(), iter->second.end());
+  }
+
+  // ------------------------------- INDEX TABLE ------------------------------
+
+  template <class T>
+  void monero_tx_index::table<T>::add(const std::pair<crypto::hash, T>& payment) {
+    uint64_t height = get_indexed_height(payment.second);
+    m_by_height[height].push_back(payment);
+    add_indexed_height(m_heights_by_tx_hash, get_indexed_tx_hash(payment), height);
+    if (get_indexed_payment_id(payment) != crypto::null_hash) add_indexed_height(m_heights_by_payment_id, get_indexed_payment_id(payment), height); // txs without payment id are never queried by it
+    add_indexed_height(m_heights_by_account, get_indexed_account(payment), height);
+  }
+
+  template <class T>
+  void monero_tx_index::table<T>::erase_from(uint64_t height) {
+    for (auto iter = m_by_height.lower_bound(height); iter != m_by_height.end(); iter = m_by_height.erase(iter)) {
+      for (const std::pair<crypto::hash, T>& payment : iter->second) {
+        erase_indexed_height(m_heights_by_tx_hash, get_indexed_tx_hash(payment), iter->first);
+        erase_indexed_height(m_heights_by_payment_id, get_indexed_payment_id(payment), iter->first);
+        erase_indexed_height(m_heights_by_account, get_indexed_account(payment), iter->first);
+      }
+    }
+  }
+
+  template <class T>
+  void monero_tx_index::table<T>::clear() {
+    m_by_height.clear();
+    m_heights_by_tx_hash.clear();
+    m_heights_by_payment_id.clear();
+    m_heights_by_account.clear();
+  }
+
+  template <class T>
+  void monero_tx_index::table<T>::get(std::list<std::pair<crypto::hash, T>>& payments, const monero_tx_index_query& query) const {
+    if (query.m_min_height >= query.m_max_height) return;
+
+    // scan height buckets in range if query has no indexed key
+    if (query.m_tx_hashes == boost::none && query.m_payment_ids == boost::none && query.m_account_index == boost::none) {
+      for (auto iter = m_by_height.upper_bound(query.m_min_height); iter != m_by_height.end() && iter->first <= query.m_max_height; iter++) {
+        for (const std::pair<crypto::hash, T>& payment : iter->second) {
+          if (meets_index_query(payment, query)) payments.push_back(payment);
+        }
+      }
+      return;
+    }
+
+    // otherwise collect candidate heights from the most selective key
+    std::set<uint64_t> heights;
+    if (query.m_tx_hashes != boost::none) {
+      for (const crypto::hash& tx_hash : *query.m_tx_hashes) collect_indexed_heights(m_heights_by_tx_hash, tx_hash, heights);
+    } else if (query.m_payment_ids != boost::none) {
+      for (const crypto::hash& payment_id : *query.m_payment_ids) collect_indexed_heights(m_heights_by_payment_id, payment_id, heights);
+    } else {
+      collect_indexed_heights(m_heights_by_account, *query.m_account_index, heights);
+    }
+
+    // scan candidate height buckets in range
+    for (auto iter = heights.upper_bound(query.m_min_height); iter != heights.end() && *iter <= query.m_max_height; iter++) {
+      for (const std::pair<crypto::hash, T>& payment : m_by_height.at(*iter)) {
+        if (meets_index_query(payment, query)) payments.push_back(payment);
+      }
+    }
+  }
+
+  // ------------------------------ MONERO TX INDEX ---------------------------
+
+  monero_tx_index::monero_tx_index(const tools::wallet2& w2) : m_w2(w2), m_is_initialized(false), m_last_block_height(0), m_indexed_height(0) { }
+
+  bool monero_tx_index::is_initialized() const {
+    return m_is_initialized;
+  }
+
+  void monero_tx_index::mark_dirty(uint64_t height) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    if (m_dirty_height == boost::none || height < *m_dirty_height) m_dirty_height = height;
+  }
+
+  void monero_tx_index::on_new_block(uint64_t height) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    if (m_is_initialized && height <= m_last_block_height && (m_dirty_height == boost::none || height < *m_dirty_height)) m_dirty_height = height; // reorg replaced indexed blocks
+    m_last_block_height = height;
+  }
+
+  void monero_tx_index::invalidate() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    m_is_initialized = false;
+    m_dirty_height = boost::none;
+    m_payments.clear();
+    m_payments_out.clear();
+  }
+
+  void monero_tx_index::update() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    update_aux();
+  }
+
+  void monero_tx_index::get_payments(std::list<std::pair<crypto::hash, tools::wallet2::payment_details>>& payments, const monero_tx_index_query& query) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    update_aux();
+    m_payments.get(payments, query);
+  }
+
+  void monero_tx_index::get_payments_out(std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>>& payments, const monero_tx_index_query& query) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    update_aux();
+    m_payments_out.get(payments, query);
+  }
+
+  uint64_t monero_tx_index::get_window_end(uint64_t min_height, size_t num_payments) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    update_aux();
+
+    // walk incoming and outgoing buckets in height order until enough payments are counted
+    auto in_iter = m_payments.m_by_height.lower_bound(min_height);
+    auto out_iter = m_payments_out.m_by_height.lower_bound(min_height);
+    size_t count = 0;
+    while (in_iter != m_payments.m_by_height.end() || out_iter != m_payments_out.m_by_height.end()) {
+      uint64_t height;
+      if (out_iter == m_payments_out.m_by_height.end() || (in_iter != m_payments.m_by_height.end() && in_iter->first <= out_iter->first)) height = in_iter->first;
+      else height = out_iter->first;
+      if (in_iter != m_payments.m_by_height.end() && in_iter->first == height) count += (in_iter++)->second.size();
+      if (out_iter != m_payments_out.m_by_height.end() && out_iter->first == height) count += (out_iter++)->second.size();
+      if (count >= num_payments) return height;
+    }
+    return CRYPTONOTE_MAX_BLOCK_NUMBER;
+  }
+
+  // ------------------------------- PRIVATE HELPERS ----------------------------
+
+  void monero_tx_index::update_aux() {
+
+    // reload from wallet height if blocks were detached without being replaced
+    uint64_t height = m_w2.get_blockchain_current_height();
+    if (m_is_initialized && height < m_indexed_height && (m_dirty_height == boost::none || height < *m_dirty_height)) m_dirty_height = height;
+
+    // determine height to (re)load payments from
+    uint64_t start_height;
+    if (!m_is_initialized) start_height = 0;
+    else if (m_dirty_height != boost::none) start_height = *m_dirty_height;
+    else return;
+    MTRACE("monero_tx_index loading payments from height " << start_height);
+
+    // drop payments at or above start height
+    m_payments.erase_from(start_height);
+    m_payments_out.erase_from(start_height);
+
+    // load incoming payments at or above start height (wallet2 min height is exclusive)
+    uint64_t min_height = start_height == 0 ? 0 : start_height - 1;
+    std::list<std::pair<crypto::hash, tools::wallet2::payment_details>> payments;
+    m_w2.get_payments(payments, min_height, CRYPTONOTE_MAX_BLOCK_NUMBER, boost::none, std::set<uint32_t>());
+    for (const std::pair<crypto::hash, tools::wallet2::payment_details>& payment : payments) m_payments.add(payment);
+
+    // load outgoing payments at or above start height
+    std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>> payments_out;
+    m_w2.get_payments_out(payments_out, min_height, CRYPTONOTE_MAX_BLOCK_NUMBER, boost::none, std::set<uint32_t>());
+    for (std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>& payment : payments_out) {
+      payment.second.m_tx = cryptonote::transaction_prefix(); // tx and rings are not used to build txs so don't keep copies
+      payment.second.m_rings.clear();
+      m_payments_out.add(payment);
+    }
+
+    if (!m_is_initialized) m_last_block_height = height - 1;
+    m_is_initialized = true;
+    m_dirty_height = boost::none;
+    m_indexed_height = height;
+  }
+}
@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include "wallet/wallet2.h"
+
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+
+/**
+ * Index of a wallet's confirmed transaction history.
+ */
+namespace monero {
+
+  /**
+   * Selects a slice of indexed transactions.
+   *
+   * Heights follow wallet2::get_payments(): min height is exclusive and max height is inclusive.
+   */
+  struct monero_tx_index_query {
+    uint64_t m_min_height;
+    uint64_t m_max_height;
+    boost::optional<uint32_t> m_account_index;
+    std::set<uint32_t> m_subaddress_indices;
+    boost::optional<std::set<crypto::hash>> m_tx_hashes;    // none if unrestricted
+    boost::optional<std::set<crypto::hash>> m_payment_ids;  // none if unrestricted
+    monero_tx_index_query() : m_min_height(0), m_max_height(CRYPTONOTE_MAX_BLOCK_NUMBER) {}
+  };
+
+  /**
+   * Wallet-resident index of confirmed incoming and outgoing payments.
+   *
+   * Payments are copied from wallet2 once, bucketed by height, and indexed by tx hash,
+   * payment id, and account so queries read only the matching slice instead of every
+   * payment in the wallet.  The index is updated incrementally from the lowest height at
+   * which wallet2 added payments or replaced blocks in a reorg since the last update, so
+   * blocks without wallet txs do not reload payments.
+   *
+   * Unconfirmed payments are not indexed since they change with the pool on every query.
+   */
+  class monero_tx_index {
+
+  public:
+
+    /**
+     * Construct an index over the given wallet.
+     *
+     * @param w2 is the wallet whose confirmed payments are indexed
+     */
+    monero_tx_index(const tools::wallet2& w2);
+
+    /**
+     * Indicates if the index has been built.
+     */
+    bool is_initialized() const;
+
+    /**
+     * Record that wallet2 added payments at the given height, so indexed payments at or
+     * above the height must be reloaded.
+     *
+     * @param height is the height of the block with the payments
+     */
+    void mark_dirty(uint64_t height);
+
+    /**
+     * Record that wallet2 processed a block, which marks the index dirty from its height
+     * if it replaces an indexed block.
+     *
+     * @param height is the height of the processed block
+     */
+    void on_new_block(uint64_t height);
+
+    /**
+     * Discard all indexed payments so the index is rebuilt on next use (e.g. after a rescan
+     * or import which changes wallet history at arbitrary heights).
+     */
+    void invalidate();
+
+    /**
+     * Build the index if uninitialized, otherwise reload payments from the lowest dirty height.
+     */
+    void update();
+
+    /**
+     * Get indexed incoming payments, updating the index first if necessary.
+     *
+     * @param payments are populated with payments matching the query in ascending height order
+     * @param query selects the payments to get
+     */
+    void get_payments(std::list<std::pair<crypto::hash, tools::wallet2::payment_details>>& payments, const monero_tx_index_query& query);
+
+    /**
+     * Get indexed outgoing payments, updating the index first if necessary.
+     *
+     * @param payments are populated with payments matching the query in ascending height order
+     * @param query selects the payments to get
+     */
+    void get_payments_out(std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>>& payments, const monero_tx_index_query& query);
+
+    /**
+     * Get the end of the smallest height window which holds the given number of indexed
+     * payments, updating the index first if necessary.  Used to bound the heights fetched
+     * for one page of results.
+     *
+     * @param min_height is the first height of the window (inclusive)
+     * @param num_payments is the number of incoming and outgoing payments the window must hold
+     * @return the last height of the window (inclusive), CRYPTONOTE_MAX_BLOCK_NUMBER if fewer payments are indexed
+     */
+    uint64_t get_window_end(uint64_t min_height, size_t num_payments);
+
+    // --------------------------------- PRIVATE --------------------------------
+
+  private:
+
+    /**
+     * Payments of one type bucketed by height with secondary indices from each key to the
+     * heights of its payments.
+     */
+    template <class T>
+    struct table {
+      std::map<uint64_t, std::vector<std::pair<crypto::hash, T>>> m_by_height;
+      std::unordered_map<crypto::hash, std::set<uint64_t>> m_heights_by_tx_hash;
+      std::unordered_map<crypto::hash, std::set<uint64_t>> m_heights_by_payment_id;
+      std::unordered_map<uint32_t, std::set<uint64_t>> m_heights_by_account;
+      void add(const std::pair<crypto::hash, T>& payment);
+      void erase_from(uint64_t height);
+      void clear();
+      void get(std::list<std::pair<crypto::hash, T>>& payments, const monero_tx_index_query& query) const;
+    };
+
+    const tools::wallet2& m_w2;                      // wallet whose payments are indexed
+    boost::mutex m_mutex;                            // synchronize updates and reads
+    std::atomic<bool> m_is_initialized;              // whether or not the index is built
+    boost::optional<uint64_t> m_dirty_height;        // lowest height with added payments or replaced blocks since last update
+    uint64_t m_last_block_height;                    // height of the last processed block
+    uint64_t m_indexed_height;                       // wallet height when last updated
+    table<tools::wallet2::payment_details> m_payments;
+    table<tools::wallet2::confirmed_transfer_details> m_payments_out;
+    void update_aux();
+  };
+}
@@ -53,8 +53,10 @@
 #pragma once
 
 #include "monero_wallet_model.h"
+#include "monero_result_arena.h"
 #include <vector>
 #include <set>
+#include <future>
 
 using namespace monero;
 
@@ -110,6 +112,26 @@ namespace monero {
      * @param output - the spent output
      */
     virtual void on_output_spent(const monero_output_wallet& output) {};
+
+    /**
+     * Invoked with the outputs received in one block, or in one batch interval
+     * while syncing.  Calls on_output_received() for each output by default.
+     *
+     * @param outputs - the received outputs, whose txs and blocks are shared within the batch
+     */
+    virtual void on_outputs_received(const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) {
+      for (const std::shared_ptr<monero_output_wallet>& output : outputs) on_output_received(*output);
+    };
+
+    /**
+     * Invoked with the outputs spent in one block, or in one batch interval while
+     * syncing.  Calls on_output_spent() for each output by default.
+     *
+     * @param outputs - the spent outputs, whose txs and blocks are shared within the batch
+     */
+    virtual void on_outputs_spent(const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) {
+      for (const std::shared_ptr<monero_output_wallet>& output : outputs) on_output_spent(*output);
+    };
   };
 
   // forward declaration of internal wallet2 listener
@@ -305,6 +327,20 @@ namespace monero {
       throw std::runtime_error("get_address() not supported");
     }
 
+    /**
+     * Get the addresses of a contiguous range of subaddresses.
+     *
+     * @param account_idx specifies the account index of the subaddresses
+     * @param begin is the first subaddress index to get the address of
+     * @param end is the subaddress index after the last to get the address of
+     * @param addresses is resized to end - begin and filled with the addresses in index order
+     */
+    virtual void get_addresses(const uint32_t account_idx, const uint32_t begin, const uint32_t end, std::vector<std::string>& addresses) const {
+      if (begin > end) throw std::runtime_error("Subaddress range begin must be <= end");
+      addresses.resize(end - begin);
+      for (uint32_t subaddress_idx = begin; subaddress_idx < end; subaddress_idx++) addresses[subaddress_idx - begin] = get_address(account_idx, subaddress_idx);
+    }
+
     /**
      * Get the account and subaddress index of the given address.
      *
@@ -447,6 +483,25 @@ namespace monero {
       throw std::runtime_error("sync() not supported");
     }
 
+    /**
+     * Synchronize the wallet with the daemon without blocking the caller.
+     *
+     * @return a future which receives the sync result or the error which stopped it
+     */
+    virtual std::future<monero_sync_result> sync_async() {
+      throw std::runtime_error("sync_async() not supported");
+    }
+
+    /**
+     * Synchronize the wallet with the daemon without blocking the caller.
+     *
+     * @param start_height is the start height to sync from (ignored if less than last processed block)
+     * @return a future which receives the sync result or the error which stopped it
+     */
+    virtual std::future<monero_sync_result> sync_async(uint64_t start_height) {
+      throw std::runtime_error("sync_async() not supported");
+    }
+
     /**
      * Start an asynchronous thread to continuously synchronize the wallet with the daemon.
      */
@@ -697,6 +752,19 @@ namespace monero {
       throw std::runtime_error("get_txs(query, missing_tx_hashes) not supported");
     }
 
+    /**
+     * Same as get_txs(query) but builds the results in the given arena, which
+     * frees them all at once when destroyed.  Wallets which do not build results
+     * in an arena return heap-owned results.
+     *
+     * @param query filters results
+     * @param arena owns the results, which are invalid after it is destroyed
+     * @return wallet transactions per the query
+     */
+    virtual std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(const monero_tx_query& query, monero_result_arena& arena) const {
+      return get_txs(query);
+    }
+
     /**
      * Get incoming and outgoing transfers to and from this wallet.  An outgoing
      * transfer represents a total amount sent from one or more subaddresses
@@ -717,6 +785,33 @@ namespace monero {
       throw std::runtime_error("get_transfers() not supported");
     }
 
+    /**
+     * Same as get_transfers(query) but builds the results in the given arena.
+     *
+     * @param query filters results
+     * @param arena owns the results, which are invalid after it is destroyed
+     * @return wallet transfers per the query
+     */
+    virtual std::vector<std::shared_ptr<monero_transfer>> get_transfers(const monero_transfer_query& query, monero_result_arena& arena) const {
+      return get_transfers(query);
+    }
+
+    /**
+     * Get one page of the transfers get_transfers() returns, in ascending
+     * height order with unconfirmed transfers last, so long histories can be
+     * walked without holding every transfer at once.
+     *
+     * A full page always has a next cursor, which may lead to an empty page.
+     *
+     * @param query specifies query options
+     * @param cursor is the position to start from, default-constructed to start at the beginning
+     * @param limit is the maximum number of transfers to return
+     * @return the transfers and the cursor of the next page if any
+     */
+    virtual monero_transfer_page get_transfers_page(const monero_transfer_query& query, const monero_page_cursor& cursor, uint32_t limit) const {
+      throw std::runtime_error("get_transfers_page() not supported");
+    }
+
     /**
      * Get outputs created from previous transactions that belong to the wallet
      * (i.e. that the wallet can spend one time).  Outputs are part of
@@ -733,6 +828,33 @@ namespace monero {
       throw std::runtime_error("get_outputs() not supported");
     }
 
+    /**
+     * Same as get_outputs(query) but builds the results in the given arena.
+     *
+     * @param query filters results
+     * @param arena owns the results, which are invalid after it is destroyed
+     * @return wallet outputs per the query
+     */
+    virtual std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(const monero_output_query& query, monero_result_arena& arena) const {
+      return get_outputs(query);
+    }
+
+    /**
+     * Get one page of the outputs get_outputs() returns, in ascending height
+     * order, so large wallets can be walked without holding every output at
+     * once.
+     *
+     * A full page always has a next cursor, which may lead to an empty page.
+     *
+     * @param query specifies query options
+     * @param cursor is the position to start from, default-constructed to start at the beginning
+     * @param limit is the maximum number of outputs to return
+     * @return the outputs and the cursor of the next page if any
+     */
+    virtual monero_output_page get_outputs_page(const monero_output_query& query, const monero_page_cursor& cursor, uint32_t limit) const {
+      throw std::runtime_error("get_outputs_page() not supported");
+    }
+
     /**
      * Export all outputs in hex format.
      *
@@ -794,6 +916,16 @@ namespace monero {
       throw std::runtime_error("create_txs() not supported");
     }
 
+    /**
+     * Create one or more transactions without blocking the caller.
+     *
+     * @param config configures the transactions to create
+     * @return a future which receives the created transactions or the error which stopped them
+     */
+    virtual std::future<std::vector<std::shared_ptr<monero_tx_wallet>>> create_txs_async(const monero_tx_config& config) {
+      throw std::runtime_error("create_txs_async() not supported");
+    }
+
     /**
      * Sweep unlocked funds according to the given config.
      *
@@ -868,6 +1000,16 @@ namespace monero {
       throw std::runtime_error("relay_txs() not supported");
     }
 
+    /**
+     * Relay transactions previously created without relaying, without blocking the caller.
+     *
+     * @param tx_metadatas are transaction metadata previously created without relaying
+     * @return a future which receives the hashes of the relayed txs or the error which stopped them
+     */
+    virtual std::future<std::vector<std::string>> relay_txs_async(const std::vector<std::string>& tx_metadatas) {
+      throw std::runtime_error("relay_txs_async() not supported");
+    }
+
     /**
      * Parses a tx set containing unsigned or multisig tx hex to a new tx set containing structured transactions.
      *
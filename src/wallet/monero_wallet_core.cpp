@@ -52,8 +52,13 @@
 
 #include "monero_wallet_core.h"
 
+#include "utils/gen_utils.h"
 #include "utils/monero_utils.h"
+#include "common/threadpool.h"
+#include <boost/thread/recursive_mutex.hpp>
 #include <chrono>
+#include <deque>
+#include <random>
 #include <iostream>
 #include "mnemonics/electrum-words.h"
 #include "mnemonics/english.h"
@@ -76,8 +81,15 @@ namespace monero {
   // ------------------------- INITIALIZE CONSTANTS ---------------------------
 
   static const int DEFAULT_SYNC_INTERVAL_MILLIS = 1000 * 10;   // default refresh interval 10 sec
+  static const int MAX_SYNC_BACKOFF = 8;                         // max multiple of the sync interval between syncs while the chain is idle
+  static const int MAX_SYNC_STEP_MILLIS = 1000 * 10;             // max time one auto sync step refreshes before yielding its shared worker to other wallets
+  static const int ASYNC_SYNC_RETRY_MILLIS = 100;                // time an async sync waits to retry while another sync runs
+  static const int SYNC_HANDOFF_MILLIS = 1000 * 2;               // min time sync holds wallet2 before handing it to waiting queries and delivering notifications
+  static const double SYNC_INTERVAL_JITTER = 0.2;                // max fraction the sync interval is randomly varied by to spread wallets' requests
   static const int DEFAULT_CONNECTION_TIMEOUT_MILLIS = 1000 * 30; // default connection timeout 30 sec
-  static const bool STRICT = false; // relies exclusively on blockchain data if true, includes local wallet data if false TODO: good use case to expose externally?
+  static const int DEFAULT_DAEMON_STATUS_TTL_MILLIS = 1000 * 120; // default max age of the cached daemon status 2 min, after which the auto sync loop probes the full status instead of only the height
+  static thread_local const monero_wallet_core* t_w2_writer = nullptr; // wallet whose wallet2 state is exclusively locked by this thread
+  static thread_local std::vector<const monero_wallet_core*> t_w2_readers; // wallets whose wallet2 state is shared locked by this thread
 
   // ----------------------- INTERNAL PRIVATE HELPERS -----------------------
 
@@ -112,31 +124,140 @@ namespace monero {
     return false;
   }
 
+  /**
+   * Deep copy a transfer query and give the copy a tx query which references it.
+   *
+   * @param query is the query to copy
+   * @return the normalized copy
+   */
+  std::shared_ptr<monero_transfer_query> copy_and_normalize(const monero_transfer_query& query) {
+    std::shared_ptr<monero_transfer_query> _query;
+    if (query.m_tx_query == boost::none) {
+      std::shared_ptr<monero_transfer_query> query_ptr = std::make_shared<monero_transfer_query>(query); // convert to shared pointer for copy  // TODO: does this copy unecessarily? copy constructor is not defined
+      _query = query_ptr->copy(query_ptr, std::make_shared<monero_transfer_query>());
+      _query->m_tx_query = std::make_shared<monero_tx_query>();
+      _query->m_tx_query.get()->m_transfer_query = _query;
+    } else {
+      std::shared_ptr<monero_tx_query> tx_query = query.m_tx_query.get()->copy(query.m_tx_query.get(), std::make_shared<monero_tx_query>());
+      _query = tx_query->m_transfer_query.get();
+    }
+    return _query;
+  }
+
+  /**
+   * Deep copy an output query and give the copy a tx query.
+   *
+   * @param query is the query to copy
+   * @return the normalized copy
+   */
+  std::shared_ptr<monero_output_query> copy_and_normalize(const monero_output_query& query) {
+    std::shared_ptr<monero_output_query> _query;
+    if (query.m_tx_query == boost::none) {
+      std::shared_ptr<monero_output_query> query_ptr = std::make_shared<monero_output_query>(query); // convert to shared pointer for copy
+      _query = query_ptr->copy(query_ptr, std::make_shared<monero_output_query>());
+    } else {
+      std::shared_ptr<monero_tx_query> tx_query = query.m_tx_query.get()->copy(query.m_tx_query.get(), std::make_shared<monero_tx_query>());
+      if (query.m_tx_query.get()->m_output_query != boost::none && query.m_tx_query.get()->m_output_query.get().get() == &query) {
+        _query = tx_query->m_output_query.get();
+      } else {
+        if (query.m_tx_query.get()->m_output_query != boost::none) throw std::runtime_error("Output query's tx query must be a circular reference or null");
+        std::shared_ptr<monero_output_query> query_ptr = std::make_shared<monero_output_query>(query);  // convert query to shared pointer for copy
+        _query = query_ptr->copy(query_ptr, std::make_shared<monero_output_query>());
+        _query->m_tx_query = tx_query;
+      }
+    }
+    if (_query->m_tx_query == boost::none) _query->m_tx_query = std::make_shared<monero_tx_query>();
+    return _query;
+  }
+
   bool bool_equals(bool val, const boost::optional<bool>& opt_val) {
     return opt_val == boost::none ? false : val == *opt_val;
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_incoming_transfer(const tools::wallet2& m_w2, uint64_t height, const crypto::hash &payment_id, const tools::wallet2::payment_details &pd) {
+  /**
+   * Get the tx hashes a tx query is restricted to.
+   *
+   * @param tx_query is the query to get tx hashes from
+   * @return the tx hashes or none if the query is not restricted by hash
+   */
+  boost::optional<std::set<crypto::hash>> get_tx_hashes(const monero_tx_query& tx_query) {
+    if (tx_query.m_hash == boost::none && tx_query.m_hashes.empty()) return boost::none;
+    std::set<crypto::hash> tx_hashes;
+    const std::vector<std::string> hashes = tx_query.m_hash == boost::none ? tx_query.m_hashes : std::vector<std::string>{ *tx_query.m_hash };
+    for (const std::string& hash : hashes) {
+      crypto::hash tx_hash;
+      if (epee::string_tools::hex_to_pod(hash, tx_hash)) tx_hashes.insert(tx_hash); // invalid hashes match no txs
+    }
+    return tx_hashes;
+  }
+
+  /**
+   * Get the payment ids a tx query is restricted to, as stored by wallet2.
+   *
+   * @param tx_query is the query to get payment ids from
+   * @return the payment ids or none if the query is not restricted by payment id
+   */
+  boost::optional<std::set<crypto::hash>> get_payment_ids(const monero_tx_query& tx_query) {
+    if (tx_query.m_payment_id == boost::none && tx_query.m_payment_ids.empty()) return boost::none;
+    std::set<crypto::hash> payment_ids;
+    const std::vector<std::string> hexes = tx_query.m_payment_id == boost::none ? tx_query.m_payment_ids : std::vector<std::string>{ *tx_query.m_payment_id };
+    for (const std::string& hex : hexes) {
+      crypto::hash payment_id = crypto::null_hash;
+      crypto::hash8 payment_id8;
+      if (hex.size() == sizeof(crypto::hash8) * 2 && epee::string_tools::hex_to_pod(hex, payment_id8)) {
+        memcpy(payment_id.data, payment_id8.data, sizeof(crypto::hash8)); // short payment ids are stored zero padded
+        payment_ids.insert(payment_id);
+      } else if (epee::string_tools::hex_to_pod(hex, payment_id)) {
+        payment_ids.insert(payment_id);
+      }
+    }
+    return payment_ids;
+  }
+
+  /**
+   * Construct a result object in the arena if given, otherwise on the heap.
+   */
+  template <class T>
+  std::shared_ptr<T> make_result(monero_result_arena* arena) {
+    return arena == nullptr ? std::make_shared<T>() : arena->make<T>();
+  }
+
+  /**
+   * Convert a wallet2 payment id to its short form if only the first 8 bytes
+   * are set, or to none if the payment id is the default (all zeros).
+   */
+  monero_lazy_hex to_payment_id(const crypto::hash& payment_id) {
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(payment_id.data);
+    bool has_short = false;
+    for (size_t i = 0; i < sizeof(crypto::hash8); i++) has_short |= data[i] != 0;
+    for (size_t i = sizeof(crypto::hash8); i < sizeof(crypto::hash); i++) {
+      if (data[i] != 0) return monero_lazy_hex::from_pod(payment_id);
+    }
+    if (!has_short) return boost::none;  // clear default payment id
+    crypto::hash8 payment_id8;
+    memcpy(payment_id8.data, payment_id.data, sizeof(crypto::hash8));
+    return monero_lazy_hex::from_pod(payment_id8);  // TODO monero core: this should be part of core wallet
+  }
+
+  std::shared_ptr<monero_tx_wallet> build_tx_with_incoming_transfer(const tools::wallet2& m_w2, uint64_t height, const crypto::hash &payment_id, const tools::wallet2::payment_details &pd, monero_result_arena* arena) {
 
     // construct block
-    std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
+    std::shared_ptr<monero_block> block = make_result<monero_block>(arena);
     block->m_height = pd.m_block_height;
     block->m_timestamp = pd.m_timestamp;
 
     // construct tx
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
+    std::shared_ptr<monero_tx_wallet> tx = make_result<monero_tx_wallet>(arena);
     tx->m_block = block;
     block->m_txs.push_back(tx);
-    tx->m_hash = epee::string_tools::pod_to_hex(pd.m_tx_hash);
+    tx->m_hash = monero_lazy_hex::from_pod(pd.m_tx_hash);
     tx->m_is_incoming = true;
-    tx->m_payment_id = epee::string_tools::pod_to_hex(payment_id);
-    if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero core: this should be part of core wallet
-    if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
+    tx->m_payment_id = to_payment_id(payment_id);
     tx->m_unlock_time = pd.m_unlock_time;
     tx->m_is_locked = !m_w2.is_transfer_unlocked(pd.m_unlock_time, pd.m_block_height);
     tx->m_fee = pd.m_fee;
-    tx->m_note = m_w2.get_tx_note(pd.m_tx_hash);
-    if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
+    std::string note = m_w2.get_tx_note(pd.m_tx_hash);
+    if (!note.empty()) tx->m_note = note; // boxed only if set
     tx->m_is_miner_tx = pd.m_coinbase ? true : false;
     tx->m_is_confirmed = true;
     tx->m_is_failed = false;
@@ -151,7 +272,7 @@ namespace monero {
     else tx->m_num_confirmations = height - *block->m_height;
 
     // construct transfer
-    std::shared_ptr<monero_incoming_transfer> incoming_transfer = std::make_shared<monero_incoming_transfer>();
+    std::shared_ptr<monero_incoming_transfer> incoming_transfer = make_result<monero_incoming_transfer>(arena);
     incoming_transfer->m_tx = tx;
     tx->m_incoming_transfers.push_back(incoming_transfer);
     incoming_transfer->m_amount = pd.m_amount;
@@ -169,27 +290,25 @@ namespace monero {
     return tx;
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_outgoing_transfer(const tools::wallet2& m_w2, uint64_t height, const crypto::hash &txid, const tools::wallet2::confirmed_transfer_details &pd) {
+  std::shared_ptr<monero_tx_wallet> build_tx_with_outgoing_transfer(const tools::wallet2& m_w2, uint64_t height, const crypto::hash &txid, const tools::wallet2::confirmed_transfer_details &pd, monero_result_arena* arena) {
 
     // construct block
-    std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
+    std::shared_ptr<monero_block> block = make_result<monero_block>(arena);
     block->m_height = pd.m_block_height;
     block->m_timestamp = pd.m_timestamp;
 
     // construct tx
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
+    std::shared_ptr<monero_tx_wallet> tx = make_result<monero_tx_wallet>(arena);
     tx->m_block = block;
     block->m_txs.push_back(tx);
-    tx->m_hash = epee::string_tools::pod_to_hex(txid);
+    tx->m_hash = monero_lazy_hex::from_pod(txid);
     tx->m_is_outgoing = true;
-    tx->m_payment_id = epee::string_tools::pod_to_hex(pd.m_payment_id);
-    if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero core: this should be part of core wallet
-    if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
+    tx->m_payment_id = to_payment_id(pd.m_payment_id);
     tx->m_unlock_time = pd.m_unlock_time;
     tx->m_is_locked = !m_w2.is_transfer_unlocked(pd.m_unlock_time, pd.m_block_height);
     tx->m_fee = pd.m_amount_in - pd.m_amount_out;
-    tx->m_note = m_w2.get_tx_note(txid);
-    if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
+    std::string note = m_w2.get_tx_note(txid);
+    if (!note.empty()) tx->m_note = note; // boxed only if set
     tx->m_is_miner_tx = false;
     tx->m_is_confirmed = true;
     tx->m_is_failed = false;
@@ -203,7 +322,7 @@ namespace monero {
     else tx->m_num_confirmations = height - *block->m_height;
 
     // construct transfer
-    std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = std::make_shared<monero_outgoing_transfer>();
+    std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = make_result<monero_outgoing_transfer>(arena);
     outgoing_transfer->m_tx = tx;
     tx->m_outgoing_transfer = outgoing_transfer;
     uint64_t change = pd.m_change == (uint64_t)-1 ? 0 : pd.m_change; // change may not be known
@@ -220,7 +339,7 @@ namespace monero {
 
     // initialize destinations
     for (const auto &d: pd.m_dests) {
-      std::shared_ptr<monero_destination> destination = std::make_shared<monero_destination>();
+      std::shared_ptr<monero_destination> destination = make_result<monero_destination>(arena);
       destination->m_amount = d.amount;
       destination->m_address = d.address(m_w2.nettype(), pd.m_payment_id);
       outgoing_transfer->m_destinations.push_back(destination);
@@ -238,21 +357,19 @@ namespace monero {
     return tx;
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_incoming_transfer_unconfirmed(const tools::wallet2& m_w2, const crypto::hash &payment_id, const tools::wallet2::pool_payment_details &ppd) {
+  std::shared_ptr<monero_tx_wallet> build_tx_with_incoming_transfer_unconfirmed(const tools::wallet2& m_w2, const crypto::hash &payment_id, const tools::wallet2::pool_payment_details &ppd, monero_result_arena* arena) {
 
     // construct tx
     const tools::wallet2::payment_details &pd = ppd.m_pd;
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
-    tx->m_hash = epee::string_tools::pod_to_hex(pd.m_tx_hash);
+    std::shared_ptr<monero_tx_wallet> tx = make_result<monero_tx_wallet>(arena);
+    tx->m_hash = monero_lazy_hex::from_pod(pd.m_tx_hash);
     tx->m_is_incoming = true;
-    tx->m_payment_id = epee::string_tools::pod_to_hex(payment_id);
-    if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero core: this should be part of core wallet
-    if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
+    tx->m_payment_id = to_payment_id(payment_id);
     tx->m_unlock_time = pd.m_unlock_time;
     tx->m_is_locked = true;
     tx->m_fee = pd.m_fee;
-    tx->m_note = m_w2.get_tx_note(pd.m_tx_hash);
-    if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
+    std::string note = m_w2.get_tx_note(pd.m_tx_hash);
+    if (!note.empty()) tx->m_note = note; // boxed only if set
     tx->m_is_miner_tx = false;
     tx->m_is_confirmed = false;
     tx->m_is_failed = false;
@@ -263,7 +380,7 @@ namespace monero {
     tx->m_num_confirmations = 0;
 
     // construct transfer
-    std::shared_ptr<monero_incoming_transfer> incoming_transfer = std::make_shared<monero_incoming_transfer>();
+    std::shared_ptr<monero_incoming_transfer> incoming_transfer = make_result<monero_incoming_transfer>(arena);
     incoming_transfer->m_tx = tx;
     tx->m_incoming_transfers.push_back(incoming_transfer);
     incoming_transfer->m_amount = pd.m_amount;
@@ -280,21 +397,19 @@ namespace monero {
     return tx;
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_outgoing_transfer_unconfirmed(const tools::wallet2& m_w2, const crypto::hash &txid, const tools::wallet2::unconfirmed_transfer_details &pd) {
+  std::shared_ptr<monero_tx_wallet> build_tx_with_outgoing_transfer_unconfirmed(const tools::wallet2& m_w2, const crypto::hash &txid, const tools::wallet2::unconfirmed_transfer_details &pd, monero_result_arena* arena) {
 
     // construct tx
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
+    std::shared_ptr<monero_tx_wallet> tx = make_result<monero_tx_wallet>(arena);
     tx->m_is_failed = pd.m_state == tools::wallet2::unconfirmed_transfer_details::failed;
-    tx->m_hash = epee::string_tools::pod_to_hex(txid);
+    tx->m_hash = monero_lazy_hex::from_pod(txid);
     tx->m_is_outgoing = true;
-    tx->m_payment_id = epee::string_tools::pod_to_hex(pd.m_payment_id);
-    if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero core: this should be part of core wallet
-    if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
+    tx->m_payment_id = to_payment_id(pd.m_payment_id);
     tx->m_unlock_time = pd.m_tx.unlock_time;
     tx->m_is_locked = true;
     tx->m_fee = pd.m_amount_in - pd.m_amount_out;
-    tx->m_note = m_w2.get_tx_note(txid);
-    if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
+    std::string note = m_w2.get_tx_note(txid);
+    if (!note.empty()) tx->m_note = note; // boxed only if set
     tx->m_is_miner_tx = false;
     tx->m_is_confirmed = false;
     tx->m_is_relayed = !tx->m_is_failed.get();
@@ -304,7 +419,7 @@ namespace monero {
     tx->m_num_confirmations = 0;
 
     // construct transfer
-    std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = std::make_shared<monero_outgoing_transfer>();
+    std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = make_result<monero_outgoing_transfer>(arena);
     outgoing_transfer->m_tx = tx;
     tx->m_outgoing_transfer = outgoing_transfer;
     outgoing_transfer->m_amount = pd.m_amount_in - pd.m_change - tx->m_fee.get();
@@ -320,7 +435,7 @@ namespace monero {
 
     // initialize destinations
     for (const auto &d: pd.m_dests) {
-      std::shared_ptr<monero_destination> destination = std::make_shared<monero_destination>();
+      std::shared_ptr<monero_destination> destination = make_result<monero_destination>(arena);
       destination->m_amount = d.amount;
       destination->m_address = d.address(m_w2.nettype(), pd.m_payment_id);
       outgoing_transfer->m_destinations.push_back(destination);
@@ -338,17 +453,17 @@ namespace monero {
     return tx;
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_vout(const tools::wallet2& m_w2, const tools::wallet2::transfer_details& td) {
+  std::shared_ptr<monero_tx_wallet> build_tx_with_vout(const tools::wallet2& m_w2, const tools::wallet2::transfer_details& td, monero_result_arena* arena) {
 
     // construct block
-    std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
+    std::shared_ptr<monero_block> block = make_result<monero_block>(arena);
     block->m_height = td.m_block_height;
 
     // construct tx
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
+    std::shared_ptr<monero_tx_wallet> tx = make_result<monero_tx_wallet>(arena);
     tx->m_block = block;
     block->m_txs.push_back(tx);
-    tx->m_hash = epee::string_tools::pod_to_hex(td.m_txid);
+    tx->m_hash = monero_lazy_hex::from_pod(td.m_txid);
     tx->m_is_confirmed = true;
     tx->m_is_failed = false;
     tx->m_is_relayed = true;
@@ -358,7 +473,7 @@ namespace monero {
     tx->m_is_locked = !m_w2.is_transfer_unlocked(td);
 
     // construct output
-    std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
+    std::shared_ptr<monero_output_wallet> output = make_result<monero_output_wallet>(arena);
     output->m_tx = tx;
     tx->m_outputs.push_back(output);
     output->m_amount = td.amount();
@@ -368,33 +483,114 @@ namespace monero {
     output->m_is_spent = td.m_spent;
     output->m_is_frozen = td.m_frozen;
     if (td.m_key_image_known) {
-      output->m_key_image = std::make_shared<monero_key_image>();
-      output->m_key_image.get()->m_hex = epee::string_tools::pod_to_hex(td.m_key_image);
+      output->m_key_image = make_result<monero_key_image>(arena);
+      output->m_key_image.get()->m_hex = monero_lazy_hex::from_pod(td.m_key_image);
     }
 
     // return pointer to new tx
     return tx;
   }
 
+  /**
+   * Evaluates an output query's fields which are known from wallet2 transfer details so
+   * excluded outputs are skipped before their txs are built.
+   *
+   * Only rejects outputs which the full query would reject, so the full query must still be
+   * applied to the built outputs.
+   */
+  struct transfer_details_filter {
+
+    transfer_details_filter(const monero_output_query& query) : m_query(query), m_excludes_all(false), m_min_height(0), m_max_height(std::numeric_limits<uint64_t>::max()) {
+      m_subaddress_indices.insert(query.m_subaddress_indices.begin(), query.m_subaddress_indices.end());
+
+      // parse key image
+      if (query.m_key_image != boost::none) {
+        const std::shared_ptr<monero_key_image>& key_image = query.m_key_image.get();
+        if (key_image->m_signature != boost::none) m_excludes_all = true; // wallet outputs are built without key image signatures
+        if (key_image->m_hex != boost::none) {
+          crypto::key_image parsed;
+          if (key_image->m_hex.get_pod(parsed)) m_key_image = parsed;
+          else m_excludes_all = true;
+        }
+      }
+
+      // resolve height range and hashes from tx query
+      if (query.m_tx_query != boost::none) {
+        const std::shared_ptr<monero_tx_query>& tx_query = query.m_tx_query.get();
+        if (tx_query->m_height != boost::none) {
+          m_min_height = *tx_query->m_height;
+          m_max_height = *tx_query->m_height;
+        }
+        if (tx_query->m_min_height != boost::none) m_min_height = std::max(m_min_height, *tx_query->m_min_height);
+        if (tx_query->m_max_height != boost::none) m_max_height = std::min(m_max_height, *tx_query->m_max_height);
+        m_tx_hashes = get_tx_hashes(*tx_query);
+      }
+      if (m_min_height > m_max_height) m_excludes_all = true;
+    }
+
+    bool meets_criteria(const tools::wallet2::transfer_details& td) const {
+      if (m_excludes_all) return false;
+
+      // filter on subaddress
+      if (m_query.m_account_index != boost::none && *m_query.m_account_index != td.m_subaddr_index.major) return false;
+      if (m_query.m_subaddress_index != boost::none && *m_query.m_subaddress_index != td.m_subaddr_index.minor) return false;
+      if (!m_subaddress_indices.empty() && m_subaddress_indices.count(td.m_subaddr_index.minor) == 0) return false;
+
+      // filter on state
+      if (m_query.m_is_spent != boost::none && *m_query.m_is_spent != td.m_spent) return false;
+      if (m_query.m_is_frozen != boost::none && *m_query.m_is_frozen != td.m_frozen) return false;
+
+      // filter on amount
+      uint64_t amount = td.amount();
+      if (m_query.m_amount != boost::none && *m_query.m_amount != amount) return false;
+      if (m_query.m_min_amount != boost::none && amount < *m_query.m_min_amount) return false;
+      if (m_query.m_max_amount != boost::none && amount > *m_query.m_max_amount) return false;
+
+      // filter on key image
+      if (m_query.m_key_image != boost::none) {
+        if (!td.m_key_image_known) return false;
+        if (m_key_image != boost::none && *m_key_image != td.m_key_image) return false;
+      }
+
+      // filter on tx
+      if (td.m_block_height < m_min_height || td.m_block_height > m_max_height) return false;
+      if (m_tx_hashes != boost::none && m_tx_hashes->count(td.m_txid) == 0) return false;
+      return true;
+    }
+
+  private:
+    const monero_output_query& m_query;
+    bool m_excludes_all;                                 // query cannot match any output
+    std::set<uint32_t> m_subaddress_indices;
+    boost::optional<crypto::key_image> m_key_image;
+    uint64_t m_min_height;
+    uint64_t m_max_height;
+    boost::optional<std::set<crypto::hash>> m_tx_hashes; // none if unrestricted
+  };
+
+  typedef gen_utils::ordered_hash_map<crypto::hash, std::shared_ptr<monero_tx_wallet>> monero_tx_map;
+  typedef gen_utils::ordered_hash_map<uint64_t, std::shared_ptr<monero_block>> monero_block_map;
+
   /**
    * Merges a transaction into a unique std::set of transactions.
    *
    * TODO monero-core: skip_if_absent only necessary because incoming payments not returned
    * when sent from/to same account #4500
    *
+   * @param tx_hash is the binary hash of the transaction
    * @param tx is the transaction to merge into the existing txs
    * @param tx_map maps tx hashes to txs
    * @param block_map maps block heights to blocks
    * @param skip_if_absent specifies if the tx should not be added if it doesn't already exist
    */
-  void merge_tx(const std::shared_ptr<monero_tx_wallet>& tx, std::map<std::string, std::shared_ptr<monero_tx_wallet>>& tx_map, std::map<uint64_t, std::shared_ptr<monero_block>>& block_map, bool skip_if_absent) {
+  void merge_tx(const crypto::hash& tx_hash, const std::shared_ptr<monero_tx_wallet>& tx, monero_tx_map& tx_map, monero_block_map& block_map, bool skip_if_absent) {
     if (tx->m_hash == boost::none) throw std::runtime_error("Tx hash is not initialized");
 
     // if tx doesn't exist, add it (unless skipped)
-    std::map<std::string, std::shared_ptr<monero_tx_wallet>>::const_iterator tx_iter = tx_map.find(*tx->m_hash);
-    if (tx_iter == tx_map.end()) {
+    std::shared_ptr<monero_tx_wallet>* a_tx = tx_map.find(tx_hash);
+    if (a_tx == nullptr) {
       if (!skip_if_absent) {
-        tx_map[*tx->m_hash] = tx;
+        tx_map.insert(tx_hash, tx);
       } else {
         MWARNING("WARNING: tx does not already exist");
       }
@@ -402,29 +598,40 @@ namespace monero {
 
     // otherwise merge with existing tx
     else {
-      std::shared_ptr<monero_tx_wallet>& a_tx = tx_map[*tx->m_hash];
-      a_tx->merge(a_tx, tx);
+      (*a_tx)->merge(*a_tx, tx);
     }
 
     // if confirmed, merge tx's block
     if (tx->get_height() != boost::none) {
-      std::map<uint64_t, std::shared_ptr<monero_block>>::const_iterator block_iter = block_map.find(tx->get_height().get());
-      if (block_iter == block_map.end()) {
-        block_map[tx->get_height().get()] = tx->m_block.get();
-      } else {
-        std::shared_ptr<monero_block>& a_block = block_map[tx->get_height().get()];
-        a_block->merge(a_block, tx->m_block.get());
-      }
+      std::pair<std::shared_ptr<monero_block>*, bool> block_entry = block_map.insert(tx->get_height().get(), tx->m_block.get());
+      if (!block_entry.second) (*block_entry.first)->merge(*block_entry.first, tx->m_block.get());
     }
   }
 
   /**
-   * Returns true iff tx1's height is known to be less than tx2's height for sorting.
+   * Parse a tx's hash to binary for merging.
+   */
+  crypto::hash get_tx_hash(const monero_tx& tx) {
+    crypto::hash tx_hash;
+    if (tx.m_hash == boost::none) throw std::runtime_error("Tx hash is not initialized");
+    if (!tx.m_hash.get_pod(tx_hash)) throw std::runtime_error("Invalid tx hash: " + *tx.m_hash);
+    return tx_hash;
+  }
+
+  /**
+   * Returns true iff tx1 is ordered before tx2 by ascending height with unconfirmed txs
+   * last, breaking ties by hash so pages count results at a height in the same order.
    */
   bool tx_height_less_than(const std::shared_ptr<monero_tx>& tx1, const std::shared_ptr<monero_tx>& tx2) {
-    if (tx1->m_block != boost::none && tx2->m_block != boost::none) return tx1->get_height() < tx2->get_height();
-    else if (tx1->m_block == boost::none) return false;
-    else return true;
+    bool is_confirmed1 = tx1->m_block != boost::none;
+    bool is_confirmed2 = tx2->m_block != boost::none;
+    if (is_confirmed1 != is_confirmed2) return is_confirmed1;
+    if (is_confirmed1 && tx1->get_height() != tx2->get_height()) return tx1->get_height() < tx2->get_height();
+    if (tx1->m_hash == boost::none || tx2->m_hash == boost::none) return tx1->m_hash != boost::none;
+    crypto::hash hash1;
+    crypto::hash hash2;
+    if (tx1->m_hash.get_pod(hash1) && tx2->m_hash.get_pod(hash2)) return memcmp(&hash1, &hash2, sizeof(crypto::hash)) < 0; // same order as lowercase hex
+    return *tx1->m_hash < *tx2->m_hash;
   }
 
   /**
@@ -434,6 +641,7 @@ namespace monero {
 
     // compare by height
     if (tx_height_less_than(transfer1->m_tx, transfer2->m_tx)) return true;
+    if (tx_height_less_than(transfer2->m_tx, transfer1->m_tx)) return false;
 
     // compare by account and subaddress index
     if (transfer1->m_account_index.get() < transfer2->m_account_index.get()) return true;
@@ -450,6 +658,7 @@ namespace monero {
 
     // compare by height
     if (tx_height_less_than(ow1->m_tx, ow2->m_tx)) return true;
+    if (tx_height_less_than(ow2->m_tx, ow1->m_tx)) return false;
 
     // compare by account index, subaddress index, and output
     if (ow1->m_account_index.get() < ow2->m_account_index.get()) return true;
@@ -460,6 +669,50 @@ namespace monero {
     return false;
   }
 
+  /**
+   * Fill a page with confirmed results in ascending height order, fetching one
+   * window of heights at a time so only about one page of results is built.
+   *
+   * @param results is the page to fill
+   * @param cursor is the position to start from
+   * @param limit is the maximum number of results in the page
+   * @param min_height is the first height to page through (inclusive)
+   * @param max_height is the last height to page through (inclusive)
+   * @param get_window_end returns the last height of the smallest window from a height which can hold the given number of results
+   * @param get_results returns results within an inclusive height range in ascending height order
+   * @return the cursor of the next page if the page is full, none otherwise
+   */
+  template <class T, class W, class R>
+  boost::optional<monero_page_cursor> fill_confirmed_page(std::vector<std::shared_ptr<T>>& results, const monero_page_cursor& cursor, uint32_t limit, uint64_t min_height, uint64_t max_height, W get_window_end, R get_results) {
+    uint64_t start_height = std::max(cursor.m_height, min_height);
+    uint64_t skip = start_height == cursor.m_height ? cursor.m_offset : 0;
+    uint64_t last_height = start_height;
+    uint64_t num_at_last_height = skip;
+    for (uint64_t height = start_height; height <= max_height; ) {
+      uint64_t window_end = std::min(max_height, get_window_end(height, skip + limit - results.size()));
+      for (const std::shared_ptr<T>& result : get_results(height, window_end)) {
+        uint64_t result_height = *result->m_tx->get_height();
+        if (skip > 0 && result_height == start_height) {
+          skip--;
+          continue;
+        }
+        num_at_last_height = result_height == last_height ? num_at_last_height + 1 : 1;
+        last_height = result_height;
+        results.push_back(result);
+        if (results.size() == limit) {
+          monero_page_cursor next_cursor;
+          next_cursor.m_height = last_height;
+          next_cursor.m_offset = num_at_last_height;
+          return next_cursor;
+        }
+      }
+      if (window_end == max_height) break;
+      height = window_end + 1;
+      skip = 0;
+    }
+    return boost::none;
+  }
+
   std::string get_default_ringdb_path(cryptonote::network_type nettype)
   {
     boost::filesystem::path dir = tools::get_default_data_dir();
@@ -689,15 +942,17 @@ namespace monero {
     wallet2_listener(monero_wallet_core& wallet, tools::wallet2& m_w2) : m_wallet(wallet), m_w2(m_w2) {
       this->m_sync_start_height = boost::none;
       this->m_sync_end_height = boost::none;
+      this->m_is_delivering = false;
     }
 
     ~wallet2_listener() {
       MTRACE("~wallet2_listener()");
       m_w2.callback(nullptr);
+      for (auto& entry : m_pending_blocks) monero_utils::free(entry.second);
     }
 
     void update_listening() {
-      m_w2.callback(m_wallet.get_listeners().empty() ? nullptr : this);
+      m_w2.callback(this); // always listen to keep the tx index current
     }
 
     void on_sync_start(uint64_t start_height) {
@@ -707,73 +962,92 @@ namespace monero {
     }
 
     void on_sync_end() {
+      flush_outputs();
       m_sync_start_height = boost::none;
       m_sync_end_height = boost::none;
     }
 
     void on_new_block(uint64_t height, const cryptonote::block& cn_block) override {
+
+      // indexed txs at or above a block replaced by a reorg must be reloaded
+      m_wallet.m_tx_index->on_new_block(height);
+      bool is_unlock_due = m_wallet.m_balance_tracker->on_new_block(height);
+
+      // end the sync batch once queries or notifications are due, so they run while wallet2 is idle
+      m_wallet.end_sync_batch_if_due();
+
+      // dispatch outputs of this and previous blocks if batch is due
+      uint64_t batch_interval = m_wallet.m_listener_batch_interval;
+      if (batch_interval == 0 || std::chrono::steady_clock::now() - m_last_flush_time >= std::chrono::milliseconds(batch_interval)) flush_outputs();
       if (m_wallet.get_listeners().empty()) return;
 
       // ignore notifications before sync start height, irrelevant to clients
       if (m_sync_start_height == boost::none || height < *m_sync_start_height) return;
 
-      // notify listeners of block
-      for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-        listener->on_new_block(height);
-      }
-
-      // notify listeners of sync progress
+      // notify listeners of block and sync progress
       if (height >= *m_sync_end_height) m_sync_end_height = height + 1; // increase end height if necessary
-      double percent_done = (double) (height - *m_sync_start_height + 1) / (double) (*m_sync_end_height - *m_sync_start_height);
+      uint64_t start_height = *m_sync_start_height;
+      uint64_t end_height = *m_sync_end_height;
+      double percent_done = (double) (height - start_height + 1) / (double) (end_height - start_height);
       std::string message = std::string("Synchronizing");
-      for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-        listener->on_sync_progress(height, *m_sync_start_height, *m_sync_end_height, percent_done, message);
-      }
+      notify([this, height, start_height, end_height, percent_done, message]() {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
+          listener->on_new_block(height);
+        }
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
+          listener->on_sync_progress(height, start_height, end_height, percent_done, message);
+        }
+      });
+
+      // notify listeners of outputs unlocked by this block
+      if (is_unlock_due) m_wallet.check_for_changed_balances();
     }
 
     void on_balances_changed(uint64_t new_balance, uint64_t new_unlocked_balance) {
       if (m_wallet.get_listeners().empty()) return;
-      for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-        listener->on_balances_changed(new_balance, new_unlocked_balance);
-      }
+      notify([this, new_balance, new_unlocked_balance]() {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
+          listener->on_balances_changed(new_balance, new_unlocked_balance);
+        }
+      });
     }
 
     void on_unconfirmed_money_received(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx, uint64_t amount, const cryptonote::subaddress_index& subaddr_index) override {
       if (m_wallet.get_listeners().empty()) return;
 
-      // create library tx
+      // create library tx owned by a batch of one output
+      std::shared_ptr<output_batch> batch = std::make_shared<output_batch>();
       std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(monero_utils::cn_tx_to_tx(cn_tx, true));
-      tx->m_hash = epee::string_tools::pod_to_hex(txid);
+      batch->m_txs.push_back(tx);
+      tx->m_hash = monero_lazy_hex::from_pod(txid);
       std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
       tx->m_outputs.push_back(output);
       output->m_tx = tx;
       output->m_amount = amount;
       output->m_account_index = subaddr_index.major;
       output->m_subaddress_index = subaddr_index.minor;
+      std::vector<std::shared_ptr<monero_output_wallet>> received = output_batch::share(batch, std::vector<std::shared_ptr<monero_output_wallet>>{ output });
+      output.reset();
+      tx.reset();
+      batch.reset(); // freed once listeners release the output
 
       // notify listeners of output
-      for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-        listener->on_output_received(*output);
-      }
+      notify([this, received]() {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
+          listener->on_outputs_received(received);
+        }
+      });
 
       // notify if balances changed
       m_wallet.check_for_changed_balances();
-
-      // free memory
-      output.reset();
-      tx.reset();
     }
 
     void on_money_received(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx, uint64_t amount, const cryptonote::subaddress_index& subaddr_index, bool is_change, uint64_t unlock_time) override {
+      m_wallet.m_tx_index->mark_dirty(height); // wallet2 added an incoming payment
       if (m_wallet.get_listeners().empty()) return;
 
-      // create native library tx
-      std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
-      block->m_height = height;
-      std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(monero_utils::cn_tx_to_tx(cn_tx, true));
-      block->m_txs.push_back(tx);
-      tx->m_block = block;
-      tx->m_hash = epee::string_tools::pod_to_hex(txid);
+      // add output to pending batch
+      std::shared_ptr<monero_tx_wallet> tx = get_pending_tx(height, txid, cn_tx);
       tx->m_unlock_time = unlock_time;
       std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
       tx->m_outputs.push_back(output);
@@ -781,51 +1055,66 @@ namespace monero {
       output->m_amount = amount;
       output->m_account_index = subaddr_index.major;
       output->m_subaddress_index = subaddr_index.minor;
+      m_pending_received.push_back(output);
+    }
 
-      // notify listeners of output
-      for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-        listener->on_output_received(*output);
-      }
+    // indicates if notifications are queued for delivery
+    bool has_notifications() {
+      boost::lock_guard<boost::mutex> guarg(m_notifications_mutex);
+      return !m_notifications.empty();
+    }
 
-      // notify if balances changed
-      m_wallet.check_for_changed_balances();
+    /**
+     * Deliver queued notifications in order.  Called once wallet2 state is no longer
+     * exclusively locked by this thread, so listeners may query or modify the wallet.
+     * Notifications queued while another thread delivers are delivered by that thread.
+     */
+    void deliver_notifications() {
+      while (true) {
+        {
+          boost::unique_lock<boost::recursive_mutex> delivery_lock(m_delivery_mutex, boost::try_to_lock);
+          if (!delivery_lock.owns_lock() || m_is_delivering) return; // the delivering thread delivers these next
+          m_is_delivering = true;
+          std::deque<std::function<void()>> notifications;
+          while (true) {
+            {
+              boost::lock_guard<boost::mutex> guarg(m_notifications_mutex);
+              if (m_notifications.empty()) break;
+              notifications.swap(m_notifications);
+            }
+            for (const std::function<void()>& notification : notifications) {
+              try {
+                notification();
+              } catch (std::exception& e) {
+                MERROR("Listener failed to process notification: " << e.what());
+              }
+            }
+            notifications.clear(); // release output graphs before taking more
+          }
+          m_is_delivering = false;
+        }
 
-      // free memory
-      monero_utils::free(block);
-      output.reset();
-      tx.reset();
+        // deliver notifications queued while releasing the delivery lock
+        boost::lock_guard<boost::mutex> guarg(m_notifications_mutex);
+        if (m_notifications.empty()) return;
+      }
     }
 
     void on_money_spent(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx_in, uint64_t amount, const cryptonote::transaction& cn_tx_out, const cryptonote::subaddress_index& subaddr_index) override {
+      m_wallet.m_balance_tracker->mark_spent(cn_tx_in);
+      m_wallet.m_tx_index->mark_dirty(height); // wallet2 added an outgoing payment
       if (m_wallet.get_listeners().empty()) return;
       if (&cn_tx_in != &cn_tx_out) throw std::runtime_error("on_money_spent() in tx is different than out tx");
 
-      // create native library tx
-      std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
-      block->m_height = height;
-      std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(monero_utils::cn_tx_to_tx(cn_tx_in, true));
-      block->m_txs.push_back(tx);
-      tx->m_block = block;
-      tx->m_hash = epee::string_tools::pod_to_hex(txid);
+      // add output to pending batch
+      std::shared_ptr<monero_tx_wallet> tx = get_pending_tx(height, txid, cn_tx_in);
       std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
       tx->m_inputs.push_back(output);
       output->m_tx = tx;
       output->m_amount = amount;
       output->m_account_index = subaddr_index.major;
       output->m_subaddress_index = subaddr_index.minor;
-
-      // notify listeners of output
-      for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-        listener->on_output_spent(*output);
-      }
-
-      // notify if balances changed
-      m_wallet.check_for_changed_balances();
-
-      // free memory
-      monero_utils::free(block);
-      output.reset();
-      tx.reset();
+      m_pending_spent.push_back(output);
     }
 
   private:
@@ -833,6 +1122,92 @@ namespace monero {
     tools::wallet2& m_w2;         // internal wallet implementation to listen to
     boost::optional<uint64_t> m_sync_start_height;
     boost::optional<uint64_t> m_sync_end_height;
+
+    /**
+     * Owns the tx and block graphs of a batch of notified outputs.  Listeners receive
+     * outputs which share ownership of the batch, so a listener may keep them (e.g. to
+     * deliver them later) and the graphs are freed when the last output is released.
+     */
+    struct output_batch {
+      std::map<uint64_t, std::shared_ptr<monero_block>> m_blocks;
+      std::vector<std::shared_ptr<monero_tx_wallet>> m_txs;  // txs without a block
+      ~output_batch() {
+        for (auto& entry : m_blocks) monero_utils::free(entry.second);
+        for (std::shared_ptr<monero_tx_wallet>& tx : m_txs) {
+          for (std::shared_ptr<monero_output>& output : tx->m_outputs) output->m_tx.reset();
+        }
+      }
+      static std::vector<std::shared_ptr<monero_output_wallet>> share(const std::shared_ptr<output_batch>& batch, const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) {
+        std::vector<std::shared_ptr<monero_output_wallet>> shared_outputs;
+        shared_outputs.reserve(outputs.size());
+        for (const std::shared_ptr<monero_output_wallet>& output : outputs) shared_outputs.push_back(std::shared_ptr<monero_output_wallet>(batch, output.get()));
+        return shared_outputs;
+      }
+    };
+
+    // batch of outputs pending notification
+    std::map<uint64_t, std::shared_ptr<monero_block>> m_pending_blocks;                  // blocks of pending outputs by height
+    std::unordered_map<crypto::hash, std::shared_ptr<monero_tx_wallet>> m_pending_txs;  // txs of pending outputs by hash
+    std::vector<std::shared_ptr<monero_output_wallet>> m_pending_received;
+    std::vector<std::shared_ptr<monero_output_wallet>> m_pending_spent;
+    std::chrono::steady_clock::time_point m_last_flush_time;
+
+    // notifications queued while wallet2 state is exclusively locked, since listeners may wait on queries which need it
+    boost::mutex m_notifications_mutex;
+    std::deque<std::function<void()>> m_notifications;
+    boost::recursive_mutex m_delivery_mutex;  // held by the thread delivering notifications
+    bool m_is_delivering;                     // guarded by m_delivery_mutex, set while its owner delivers
+
+    // queue a notification and deliver it now unless this thread holds wallet2 state exclusively
+    void notify(const std::function<void()>& notification) {
+      {
+        boost::lock_guard<boost::mutex> guarg(m_notifications_mutex);
+        m_notifications.push_back(notification);
+      }
+      if (t_w2_writer != &m_wallet) deliver_notifications();
+    }
+
+    // get or create the tx of a pending output so outputs of one tx share its graph
+    std::shared_ptr<monero_tx_wallet> get_pending_tx(uint64_t height, const crypto::hash& txid, const cryptonote::transaction& cn_tx) {
+      auto iter = m_pending_txs.find(txid);
+      if (iter != m_pending_txs.end()) return iter->second;
+      std::shared_ptr<monero_block>& block = m_pending_blocks[height];
+      if (block == nullptr) {
+        block = std::make_shared<monero_block>();
+        block->m_height = height;
+      }
+      std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(monero_utils::cn_tx_to_tx(cn_tx, true));
+      block->m_txs.push_back(tx);
+      tx->m_block = block;
+      tx->m_hash = monero_lazy_hex::from_pod(txid);
+      m_pending_txs[txid] = tx;
+      return tx;
+    }
+
+    // notify listeners of pending outputs, check balances once, and free the batch
+    void flush_outputs() {
+      m_last_flush_time = std::chrono::steady_clock::now();
+      if (m_pending_received.empty() && m_pending_spent.empty()) return;
+
+      // take the batch so notifications which throw do not dispatch it again
+      std::shared_ptr<output_batch> batch = std::make_shared<output_batch>();
+      batch->m_blocks.swap(m_pending_blocks);
+      std::vector<std::shared_ptr<monero_output_wallet>> received = output_batch::share(batch, m_pending_received);
+      std::vector<std::shared_ptr<monero_output_wallet>> spent = output_batch::share(batch, m_pending_spent);
+      m_pending_received.clear();
+      m_pending_spent.clear();
+      m_pending_txs.clear();
+      batch.reset(); // freed once listeners release the outputs
+
+      // notify listeners
+      notify([this, received, spent]() {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
+          if (!received.empty()) listener->on_outputs_received(received);
+          if (!spent.empty()) listener->on_outputs_spent(spent);
+        }
+      });
+      m_wallet.check_for_changed_balances();
+    }
   };
 
   // --------------------------- STATIC WALLET UTILS --------------------------
@@ -1000,7 +1375,11 @@ namespace monero {
 
     // init wallet2 and std::set daemon connection
     if (!m_w2->init(uri, login, {}, 0, is_trusted, ssl)) throw std::runtime_error("Failed to initialize wallet with daemon connection");
-    is_connected(); // update m_is_connected cache // TODO: better naming?
+    {
+      boost::lock_guard<boost::mutex> guarg(m_daemon_status_mutex);
+      m_daemon_status_time = boost::none; // invalidate daemon status of previous connection
+    }
+    refresh_daemon_status(true); // update daemon status cache for new connection
   }
 
   void monero_wallet_core::set_daemon_connection(const boost::optional<monero_rpc_connection>& connection) {
@@ -1024,17 +1403,16 @@ namespace monero {
 
   // TODO: could return Wallet::ConnectionStatus_Disconnected, Wallet::ConnectionStatus_WrongVersion, Wallet::ConnectionStatus_Connected like wallet.cpp::connected()
   bool monero_wallet_core::is_connected() const {
-    uint32_t version = 0;
-    m_is_connected = m_w2->check_connection(&version, NULL, DEFAULT_CONNECTION_TIMEOUT_MILLIS); // TODO: should this be updated elsewhere?
-    if (!m_is_connected) return false;
-    //if (!m_w2->light_wallet() && (version >> 16) != CORE_RPC_VERSION_MAJOR) m_is_connected = false;  // wrong network type  // TODO: disallow rpc version mismatch by configuration
+    refresh_daemon_status();
     return m_is_connected;
   }
 
   bool monero_wallet_core::is_daemon_synced() const {
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
-    uint64_t daemonHeight = get_daemon_height();
-    return daemonHeight >= get_daemon_max_peer_height() && daemonHeight > 1;
+    refresh_daemon_status();
+    boost::lock_guard<boost::mutex> guarg(m_daemon_status_mutex);
+    if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
+    return m_daemon_height >= m_daemon_max_peer_height && m_daemon_height > 1;
   }
 
   bool monero_wallet_core::is_daemon_trusted() const {
@@ -1108,8 +1486,12 @@ namespace monero {
       throw std::runtime_error("Invalid address");
     }
 
-    // get index of address in wallet
+    // get index of address in wallet, falling back to the subaddress index beyond the lookahead
     auto index = m_w2->get_subaddress_index(info.address);
+    if (!index) {
+      boost::lock_guard<boost::mutex> guarg(m_subaddress_index_mutex);
+      index = m_subaddress_index.find(info.address, m_w2->get_account().get_keys(), m_w2->get_account().get_device());
+    }
     if (!index) throw std::runtime_error("Address doesn't belong to the wallet");
 
     // return indices in subaddress
@@ -1167,6 +1549,8 @@ namespace monero {
   }
 
   uint64_t monero_wallet_core::get_height() const {
+    w2_read_lock lock(*this, boost::try_to_lock);
+    if (!lock.is_readable()) return std::atomic_load(&m_balance_snapshot)->m_height;
     return m_w2->get_blockchain_current_height();
   }
 
@@ -1180,31 +1564,28 @@ namespace monero {
 
   uint64_t monero_wallet_core::get_daemon_height() const {
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
-    std::string err;
-    uint64_t result = m_w2->get_daemon_blockchain_height(err);
-    if (!err.empty()) throw std::runtime_error(err);
-    return result;
+    refresh_daemon_status();
+    boost::lock_guard<boost::mutex> guarg(m_daemon_status_mutex);
+    if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
+    return m_daemon_height;
   }
 
   uint64_t monero_wallet_core::get_daemon_max_peer_height() const {
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
-    std::string err;
-    uint64_t result = m_w2->get_daemon_blockchain_target_height(err);
-    if (!err.empty()) throw std::runtime_error(err);
-    if (result == 0) result = get_daemon_height();  // TODO monero core: target height can be 0 when daemon is synced.  Use blockchain height instead
-    return result;
+    refresh_daemon_status();
+    boost::lock_guard<boost::mutex> guarg(m_daemon_status_mutex);
+    if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
+    return m_daemon_max_peer_height;
   }
 
   void monero_wallet_core::add_listener(monero_wallet_listener& listener) {
     MTRACE("add_listener()");
     m_listeners.insert(&listener);
-    m_w2_listener->update_listening();
   }
 
   void monero_wallet_core::remove_listener(monero_wallet_listener& listener) {
     MTRACE("remove_listener()");
     m_listeners.erase(&listener);
-    if (!m_sync_loop_running) m_w2_listener->update_listening();  // listener is unregistered after sync to avoid segfault
   }
 
   std::set<monero_wallet_listener*> monero_wallet_core::get_listeners() {
@@ -1241,6 +1622,16 @@ namespace monero {
     return lock_and_sync(start_height);
   }
 
+  std::future<monero_sync_result> monero_wallet_core::sync_async() {
+    MTRACE("sync_async()");
+    return sync_async_aux(boost::none);
+  }
+
+  std::future<monero_sync_result> monero_wallet_core::sync_async(uint64_t start_height) {
+    MTRACE("sync_async(" << start_height << ")");
+    return sync_async_aux(start_height);
+  }
+
   monero_sync_result monero_wallet_core::sync(uint64_t start_height, monero_wallet_listener& listener) {
     MTRACE("sync(" << start_height << ", listener)");
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
@@ -1263,24 +1654,27 @@ namespace monero {
    */
   void monero_wallet_core::start_syncing() {
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
-    if (!m_syncing_enabled) {
-      m_syncing_enabled = true;
-      run_sync_loop();  // sync wallet on loop in background
-    }
+    boost::lock_guard<boost::mutex> guarg(m_sync_loop_mutex);
+    m_syncing_enabled = true;
+    run_sync_loop();  // sync wallet on loop in background unless its last step has not stopped it yet
   }
 
   /**
    * Stop automatic syncing as its own thread.
    */
   void monero_wallet_core::stop_syncing() {
+    boost::lock_guard<boost::mutex> guarg(m_sync_loop_mutex);
     m_syncing_enabled = false;
+    if (m_sync_loop_running) monero_sync_scheduler::get_instance().wake(m_sync_task_id);  // unschedule on next step
   }
 
   void monero_wallet_core::rescan_spent() {
     MTRACE("rescan_spent()");
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
     if (!is_daemon_trusted()) throw std::runtime_error("Rescan spent can only be used with a trusted daemon");
+    w2_write_lock lock(*this);
     m_w2->rescan_spent();
+    m_balance_tracker->invalidate();
   }
 
   // TODO: support arguments bool hard, bool refresh = true, bool keep_key_images = false
@@ -1294,39 +1688,68 @@ namespace monero {
   // isMultisigImportNeeded
 
   uint64_t monero_wallet_core::get_balance() const {
-    return m_w2->balance_all(STRICT);
+    w2_read_lock lock(*this, boost::try_to_lock);
+    if (!lock.is_readable()) return std::atomic_load(&m_balance_snapshot)->m_balance;
+    return m_balance_tracker->get_balance();
   }
 
   uint64_t monero_wallet_core::get_balance(uint32_t account_idx) const {
-    return m_w2->balance(account_idx, STRICT);
+    w2_read_lock lock(*this, boost::try_to_lock);
+    if (!lock.is_readable()) {
+      std::shared_ptr<const balance_snapshot> snapshot = std::atomic_load(&m_balance_snapshot);
+      uint64_t balance = 0;
+      for (auto iter = snapshot->m_subaddress_balances.lower_bound(std::make_pair(account_idx, (uint32_t) 0)); iter != snapshot->m_subaddress_balances.end() && iter->first.first == account_idx; iter++) balance += iter->second.first;
+      return balance;
+    }
+    return m_balance_tracker->get_balance(account_idx);
   }
 
   uint64_t monero_wallet_core::get_balance(uint32_t account_idx, uint32_t subaddress_idx) const {
-    std::map<uint32_t, uint64_t> balance_per_subaddress = m_w2->balance_per_subaddress(account_idx, STRICT);
-    auto iter = balance_per_subaddress.find(subaddress_idx);
-    return iter == balance_per_subaddress.end() ? 0 : iter->second;
+    w2_read_lock lock(*this, boost::try_to_lock);
+    if (!lock.is_readable()) {
+      std::shared_ptr<const balance_snapshot> snapshot = std::atomic_load(&m_balance_snapshot);
+      auto iter = snapshot->m_subaddress_balances.find(std::make_pair(account_idx, subaddress_idx));
+      return iter == snapshot->m_subaddress_balances.end() ? 0 : iter->second.first;
+    }
+    return m_balance_tracker->get_balance(account_idx, subaddress_idx);
   }
 
   uint64_t monero_wallet_core::get_unlocked_balance() const {
-    return m_w2->unlocked_balance_all(STRICT);
+    w2_read_lock lock(*this, boost::try_to_lock);
+    if (!lock.is_readable()) return std::atomic_load(&m_balance_snapshot)->m_unlocked_balance;
+    return m_balance_tracker->get_unlocked_balance();
   }
 
   uint64_t monero_wallet_core::get_unlocked_balance(uint32_t account_idx) const {
-    return m_w2->unlocked_balance(account_idx, STRICT);
+    w2_read_lock lock(*this, boost::try_to_lock);
+    if (!lock.is_readable()) {
+      std::shared_ptr<const balance_snapshot> snapshot = std::atomic_load(&m_balance_snapshot);
+      uint64_t unlocked_balance = 0;
+      for (auto iter = snapshot->m_subaddress_balances.lower_bound(std::make_pair(account_idx, (uint32_t) 0)); iter != snapshot->m_subaddress_balances.end() && iter->first.first == account_idx; iter++) unlocked_balance += iter->second.second;
+      return unlocked_balance;
+    }
+    return m_balance_tracker->get_unlocked_balance(account_idx);
   }
 
   uint64_t monero_wallet_core::get_unlocked_balance(uint32_t account_idx, uint32_t subaddress_idx) const {
-    std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> unlocked_balance_per_subaddress = m_w2->unlocked_balance_per_subaddress(account_idx, STRICT);
-    auto iter = unlocked_balance_per_subaddress.find(subaddress_idx);
-    return iter == unlocked_balance_per_subaddress.end() ? 0 : iter->second.first;
+    w2_read_lock lock(*this, boost::try_to_lock);
+    if (!lock.is_readable()) {
+      std::shared_ptr<const balance_snapshot> snapshot = std::atomic_load(&m_balance_snapshot);
+      auto iter = snapshot->m_subaddress_balances.find(std::make_pair(account_idx, subaddress_idx));
+      return iter == snapshot->m_subaddress_balances.end() ? 0 : iter->second.second;
+    }
+    return m_balance_tracker->get_unlocked_balance(account_idx, subaddress_idx);
   }
 
   std::vector<monero_account> monero_wallet_core::get_accounts(bool include_subaddresses, const std::string& tag) const {
     MTRACE("get_accounts(" << include_subaddresses << ", " << tag << ")");
 
-    // need transfers to inform if subaddresses used
-    std::vector<tools::wallet2::transfer_details> transfers;
-    if (include_subaddresses) m_w2->get_transfers(transfers);
+    // read balances and aggregate subaddresses while sync is not updating wallet2 transfers
+    w2_read_lock lock(*this);
+
+    // aggregate subaddresses of all accounts in one pass over transfers
+    subaddress_aggregates aggregates;
+    if (include_subaddresses) get_subaddress_aggregates(boost::none, aggregates);
 
     // build accounts
     std::vector<monero_account> accounts;
@@ -1334,9 +1757,9 @@ namespace monero {
       monero_account account;
       account.m_index = account_idx;
       account.m_primary_address = get_address(account_idx, 0);
-      account.m_balance = m_w2->balance(account_idx, STRICT);
-      account.m_unlocked_balance = m_w2->unlocked_balance(account_idx, STRICT);
-      if (include_subaddresses) account.m_subaddresses = get_subaddresses_aux(account_idx, std::vector<uint32_t>(), transfers);
+      account.m_balance = m_balance_tracker->get_balance(account_idx);
+      account.m_unlocked_balance = m_balance_tracker->get_unlocked_balance(account_idx);
+      if (include_subaddresses) account.m_subaddresses = get_subaddresses_aux(account_idx, std::vector<uint32_t>(), aggregates);
       accounts.push_back(account);
     }
 
@@ -1346,17 +1769,20 @@ namespace monero {
   monero_account monero_wallet_core::get_account(uint32_t account_idx, bool include_subaddresses) const {
     MTRACE("get_account(" << account_idx << ", " << include_subaddresses << ")");
 
-    // need transfers to inform if subaddresses used
-    std::vector<tools::wallet2::transfer_details> transfers;
-    if (include_subaddresses) m_w2->get_transfers(transfers);
+    // read balances and aggregate subaddresses while sync is not updating wallet2 transfers
+    w2_read_lock lock(*this);
+
+    // aggregate subaddresses of account
+    subaddress_aggregates aggregates;
+    if (include_subaddresses) get_subaddress_aggregates(account_idx, aggregates);
 
     // build and return account
     monero_account account;
     account.m_index = account_idx;
     account.m_primary_address = get_address(account_idx, 0);
-    account.m_balance = m_w2->balance(account_idx, STRICT);
-    account.m_unlocked_balance = m_w2->unlocked_balance(account_idx, STRICT);
-    if (include_subaddresses) account.m_subaddresses = get_subaddresses_aux(account_idx, std::vector<uint32_t>(), transfers);
+    account.m_balance = m_balance_tracker->get_balance(account_idx);
+    account.m_unlocked_balance = m_balance_tracker->get_unlocked_balance(account_idx);
+    if (include_subaddresses) account.m_subaddresses = get_subaddresses_aux(account_idx, std::vector<uint32_t>(), aggregates);
     return account;
   }
 
@@ -1364,6 +1790,7 @@ namespace monero {
     MTRACE("create_account(" << label << ")");
 
     // create account
+    w2_write_lock lock(*this);
     m_w2->add_subaddress_account(label);
 
     // initialize and return result
@@ -1379,15 +1806,18 @@ namespace monero {
     MTRACE("get_subaddresses(" << account_idx << ", ...)");
     MTRACE("Subaddress indices size: " << subaddress_indices.size());
 
-    std::vector<tools::wallet2::transfer_details> transfers;
-    m_w2->get_transfers(transfers);
-    return get_subaddresses_aux(account_idx, subaddress_indices, transfers);
+    // aggregate while sync is not updating wallet2 transfers
+    w2_read_lock lock(*this);
+    subaddress_aggregates aggregates;
+    get_subaddress_aggregates(account_idx, aggregates);
+    return get_subaddresses_aux(account_idx, subaddress_indices, aggregates);
   }
 
   monero_subaddress monero_wallet_core::create_subaddress(const uint32_t account_idx, const std::string& label) {
     MTRACE("create_subaddress(" << account_idx << ", " << label << ")");
 
     // create subaddress
+    w2_write_lock lock(*this);
     m_w2->add_subaddress(account_idx, label);
 
     // initialize and return result
@@ -1417,6 +1847,22 @@ namespace monero {
 
   std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_core::get_txs(const monero_tx_query& query, std::vector<std::string>& missing_tx_hashes) const {
     MTRACE("get_txs(query)");
+    update_pool(&query);
+    w2_read_lock lock(*this); // fetch transfers and outputs from one wallet state
+    return get_txs_aux(query, missing_tx_hashes, nullptr);
+  }
+
+  std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_core::get_txs(const monero_tx_query& query, monero_result_arena& arena) const {
+    MTRACE("get_txs(query, arena)");
+    std::vector<std::string> missing_tx_hashes;
+    update_pool(&query);
+    w2_read_lock lock(*this);
+    std::vector<std::shared_ptr<monero_tx_wallet>> txs = get_txs_aux(query, missing_tx_hashes, &arena);
+    if (!missing_tx_hashes.empty()) throw std::runtime_error("Tx not found in wallet: " + missing_tx_hashes[0]);
+    return txs;
+  }
+
+  std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_core::get_txs_aux(const monero_tx_query& query, std::vector<std::string>& missing_tx_hashes, monero_result_arena* arena) const {
 
     // copy query
     std::shared_ptr<monero_tx_query> query_sp = std::make_shared<monero_tx_query>(query); // convert to shared pointer
@@ -1436,7 +1882,7 @@ namespace monero {
     std::shared_ptr<monero_transfer_query> temp_transfer_query = std::make_shared<monero_transfer_query>();
     temp_transfer_query->m_tx_query = decontextualize(_query->copy(_query, std::make_shared<monero_tx_query>()));
     temp_transfer_query->m_tx_query.get()->m_transfer_query = temp_transfer_query;
-    std::vector<std::shared_ptr<monero_transfer>> transfers = get_transfers_aux(*temp_transfer_query);
+    std::vector<std::shared_ptr<monero_transfer>> transfers = get_transfers_aux(*temp_transfer_query, arena);
 
     // collect unique txs from transfers while retaining order
     std::vector<std::shared_ptr<monero_tx_wallet>> txs = std::vector<std::shared_ptr<monero_tx_wallet>>();
@@ -1449,10 +1895,11 @@ namespace monero {
     }
 
     // cache types into maps for merging and lookup
-    std::map<std::string, std::shared_ptr<monero_tx_wallet>> tx_map;
-    std::map<uint64_t, std::shared_ptr<monero_block>> block_map;
+    monero_tx_map tx_map;
+    monero_block_map block_map;
+    tx_map.reserve(txs.size());
     for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
-      merge_tx(tx, tx_map, block_map, false);
+      merge_tx(get_tx_hash(*tx), tx, tx_map, block_map, false);
     }
 
     // fetch and merge outputs if requested
@@ -1460,14 +1907,14 @@ namespace monero {
       std::shared_ptr<monero_output_query> temp_output_query = std::make_shared<monero_output_query>();
       temp_output_query->m_tx_query = decontextualize(_query->copy(_query, std::make_shared<monero_tx_query>()));
       temp_output_query->m_tx_query.get()->m_output_query = temp_output_query;
-      std::vector<std::shared_ptr<monero_output_wallet>> outputs = get_outputs_aux(*temp_output_query);
+      std::vector<std::shared_ptr<monero_output_wallet>> outputs = get_outputs_aux(*temp_output_query, arena);
 
       // merge output txs one time while retaining order
       std::unordered_set<std::shared_ptr<monero_tx_wallet>> output_txs;
       for (const std::shared_ptr<monero_output_wallet>& output : outputs) {
         std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(output->m_tx);
         if (output_txs.find(tx) == output_txs.end()) {
-          merge_tx(tx, tx_map, block_map, true);
+          merge_tx(get_tx_hash(*tx), tx, tx_map, block_map, true);
           output_txs.insert(tx);
         }
       }
@@ -1478,33 +1925,32 @@ namespace monero {
     _query->m_output_query = output_query;
 
     // filter txs that don't meet transfer query
+    monero_tx_query_plan plan(*_query);
     std::vector<std::shared_ptr<monero_tx_wallet>> queried_txs;
     std::vector<std::shared_ptr<monero_tx_wallet>>::iterator tx_iter = txs.begin();
     while (tx_iter != txs.end()) {
       std::shared_ptr<monero_tx_wallet> tx = *tx_iter;
-      if (_query->meets_criteria(tx.get())) {
+      if (plan.meets_criteria(tx.get())) {
         queried_txs.push_back(tx);
         tx_iter++;
       } else {
-        tx_map.erase(tx->m_hash.get());
         tx_iter = txs.erase(tx_iter);
         if (tx->m_block != boost::none) tx->m_block.get()->m_txs.erase(std::remove(tx->m_block.get()->m_txs.begin(), tx->m_block.get()->m_txs.end(), tx), tx->m_block.get()->m_txs.end()); // TODO, no way to use tx_iter?
       }
     }
     txs = queried_txs;
 
-    // special case: re-fetch txs if inconsistency caused by needing to make multiple wallet calls  // TODO monero core: offer wallet.get_txs(...)
-    for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
-      if (*tx->m_is_confirmed && tx->m_block == boost::none) return get_txs(*_query, missing_tx_hashes);
-    }
-
     // if tx hashes requested, order txs and collect missing hashes
     if (!_query->m_hashes.empty()) {
+      monero_tx_map queried_tx_map;
+      queried_tx_map.reserve(txs.size());
+      for (const std::shared_ptr<monero_tx_wallet>& tx : txs) queried_tx_map.insert(get_tx_hash(*tx), tx);
       txs.clear();
-      for (const std::string& tx_hash : _query->m_hashes) {
-        std::map<std::string, std::shared_ptr<monero_tx_wallet>>::const_iterator tx_iter = tx_map.find(tx_hash);
-        if (tx_iter != tx_map.end()) txs.push_back(tx_iter->second);
-        else missing_tx_hashes.push_back(tx_hash);
+      for (const std::string& tx_hash_hex : _query->m_hashes) {
+        crypto::hash tx_hash;
+        const std::shared_ptr<monero_tx_wallet>* tx = epee::string_tools::hex_to_pod(tx_hash_hex, tx_hash) ? queried_tx_map.find(tx_hash) : nullptr;
+        if (tx != nullptr) txs.push_back(*tx);
+        else missing_tx_hashes.push_back(tx_hash_hex);
       }
     }
 
@@ -1512,6 +1958,14 @@ namespace monero {
   }
 
   std::vector<std::shared_ptr<monero_transfer>> monero_wallet_core::get_transfers(const monero_transfer_query& query) const {
+    return get_transfers(query, nullptr);
+  }
+
+  std::vector<std::shared_ptr<monero_transfer>> monero_wallet_core::get_transfers(const monero_transfer_query& query, monero_result_arena& arena) const {
+    return get_transfers(query, &arena);
+  }
+
+  std::vector<std::shared_ptr<monero_transfer>> monero_wallet_core::get_transfers(const monero_transfer_query& query, monero_result_arena* arena) const {
 
 //    // log query
 //    if (query.m_tx_query != boost::none) {
@@ -1520,12 +1974,16 @@ namespace monero {
 //    } else std::cout << "Transfer query: " << query.serialize() << std::endl;
 
     // get transfers directly if query does not require tx context (e.g. other transfers, outputs)
-    if (!is_contextual(query)) return get_transfers_aux(query);
+    update_pool(query.m_tx_query == boost::none ? nullptr : query.m_tx_query->get());
+    w2_read_lock lock(*this);
+    if (!is_contextual(query)) return get_transfers_aux(query, arena);
 
     // otherwise get txs with full models to fulfill query
+    std::vector<std::string> missing_tx_hashes;
+    monero_transfer_query_plan plan(query);
     std::vector<std::shared_ptr<monero_transfer>> transfers;
-    for (const std::shared_ptr<monero_tx_wallet>& tx : get_txs(*(query.m_tx_query.get()))) {
-      for (const std::shared_ptr<monero_transfer>& transfer : tx->filter_transfers(query)) { // collect queried transfers, erase if excluded
+    for (const std::shared_ptr<monero_tx_wallet>& tx : get_txs_aux(*(query.m_tx_query.get()), missing_tx_hashes, arena)) {
+      for (const std::shared_ptr<monero_transfer>& transfer : tx->filter_transfers(plan)) { // collect queried transfers, erase if excluded
         transfers.push_back(transfer);
       }
     }
@@ -1533,6 +1991,14 @@ namespace monero {
   }
 
   std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_core::get_outputs(const monero_output_query& query) const {
+    return get_outputs(query, nullptr);
+  }
+
+  std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_core::get_outputs(const monero_output_query& query, monero_result_arena& arena) const {
+    return get_outputs(query, &arena);
+  }
+
+  std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_core::get_outputs(const monero_output_query& query, monero_result_arena* arena) const {
 
 //    // log query
 //    if (query.m_tx_query != boost::none) {
@@ -1541,18 +2007,114 @@ namespace monero {
 //    } else std::cout << "Output query: " << query.serialize() << std::endl;
 
     // get outputs directly if query does not require tx context (e.g. other outputs, transfers)
-    if (!is_contextual(query)) return get_outputs_aux(query);
+    if (!is_contextual(query)) {
+      w2_read_lock lock(*this);
+      return get_outputs_aux(query, arena);
+    }
+    update_pool(query.m_tx_query->get());
+    w2_read_lock lock(*this);
 
     // otherwise get txs with full models to fulfill query
+    std::vector<std::string> missing_tx_hashes;
+    monero_output_query_plan plan(query);
     std::vector<std::shared_ptr<monero_output_wallet>> outputs;
-    for (const std::shared_ptr<monero_tx_wallet>& tx : get_txs(*(query.m_tx_query.get()))) {
-      for (const std::shared_ptr<monero_output_wallet>& output : tx->filter_outputs_wallet(query)) {  // collect queried outputs, erase if excluded
+    for (const std::shared_ptr<monero_tx_wallet>& tx : get_txs_aux(*(query.m_tx_query.get()), missing_tx_hashes, arena)) {
+      for (const std::shared_ptr<monero_output_wallet>& output : tx->filter_outputs_wallet(plan)) {  // collect queried outputs, erase if excluded
         outputs.push_back(output);
       }
     }
     return outputs;
   }
 
+  monero_transfer_page monero_wallet_core::get_transfers_page(const monero_transfer_query& query, const monero_page_cursor& cursor, uint32_t limit) const {
+    MTRACE("get_transfers_page(query, cursor, limit)");
+    if (limit == 0) throw std::runtime_error("Page limit must be greater than 0");
+
+    // copy query to narrow per window
+    std::shared_ptr<monero_transfer_query> _query = copy_and_normalize(query);
+    std::shared_ptr<monero_tx_query> tx_query = _query->m_tx_query.get();
+    boost::optional<bool> is_confirmed = tx_query->m_is_confirmed;
+    boost::optional<uint64_t> min_height = tx_query->m_min_height;
+    boost::optional<uint64_t> max_height = tx_query->m_max_height;
+    if (tx_query->m_height != boost::none) {
+      if (min_height == boost::none || *min_height < *tx_query->m_height) min_height = *tx_query->m_height;
+      if (max_height == boost::none || *max_height > *tx_query->m_height) max_height = *tx_query->m_height;
+    }
+    monero_transfer_page page;
+
+    // page through confirmed transfers by windows of heights
+    if (cursor.m_is_confirmed && !bool_equals(false, is_confirmed)) {
+      tx_query->m_is_confirmed = true;
+      page.m_next_cursor = fill_confirmed_page(page.m_transfers, cursor, limit, min_height == boost::none ? 0 : *min_height, max_height == boost::none ? CRYPTONOTE_MAX_BLOCK_NUMBER : std::min((uint64_t) CRYPTONOTE_MAX_BLOCK_NUMBER, *max_height), [this](uint64_t height, size_t num_transfers) {
+        w2_read_lock lock(*this);
+        return m_tx_index->get_window_end(height, num_transfers); // every transfer is one indexed payment
+      }, [&](uint64_t window_start, uint64_t window_end) {
+        tx_query->m_min_height = window_start;
+        tx_query->m_max_height = window_end;
+        return get_transfers(*_query);
+      });
+      if (page.m_next_cursor != boost::none) return page;
+    }
+
+    // page through unconfirmed transfers last
+    if (!bool_equals(true, is_confirmed)) {
+      tx_query->m_is_confirmed = false;
+      tx_query->m_min_height = min_height;
+      tx_query->m_max_height = max_height;
+      std::vector<std::shared_ptr<monero_transfer>> transfers = get_transfers(*_query);
+      uint64_t offset = cursor.m_is_confirmed ? 0 : cursor.m_offset;
+      for (uint64_t i = offset; i < transfers.size(); i++) {
+        page.m_transfers.push_back(transfers[i]);
+        if (page.m_transfers.size() == limit) {
+          monero_page_cursor next_cursor;
+          next_cursor.m_is_confirmed = false;
+          next_cursor.m_offset = i + 1;
+          page.m_next_cursor = next_cursor;
+          break;
+        }
+      }
+    }
+    return page;
+  }
+
+  monero_output_page monero_wallet_core::get_outputs_page(const monero_output_query& query, const monero_page_cursor& cursor, uint32_t limit) const {
+    MTRACE("get_outputs_page(query, cursor, limit)");
+    if (limit == 0) throw std::runtime_error("Page limit must be greater than 0");
+    monero_output_page page;
+    if (!cursor.m_is_confirmed) return page; // outputs are only confirmed
+
+    // copy query to narrow per window
+    std::shared_ptr<monero_output_query> _query = copy_and_normalize(query);
+    std::shared_ptr<monero_tx_query> tx_query = _query->m_tx_query.get();
+    uint64_t min_height = tx_query->m_min_height == boost::none ? 0 : *tx_query->m_min_height;
+    uint64_t max_height = tx_query->m_max_height == boost::none ? CRYPTONOTE_MAX_BLOCK_NUMBER : std::min((uint64_t) CRYPTONOTE_MAX_BLOCK_NUMBER, *tx_query->m_max_height);
+    if (tx_query->m_height != boost::none) {
+      min_height = std::max(min_height, *tx_query->m_height);
+      max_height = std::min(max_height, *tx_query->m_height);
+    }
+
+    // page through outputs by windows of heights
+    page.m_next_cursor = fill_confirmed_page(page.m_outputs, cursor, limit, min_height, max_height, [this](uint64_t height, size_t num_outputs) {
+      w2_read_lock lock(*this);
+
+      // wallet2 outputs are stored in ascending height order
+      size_t lo = 0;
+      size_t hi = m_w2->get_num_transfer_details();
+      while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m_w2->get_transfer_details(mid).m_block_height < height) lo = mid + 1;
+        else hi = mid;
+      }
+      if (num_outputs == 0 || lo + num_outputs > m_w2->get_num_transfer_details()) return (uint64_t) CRYPTONOTE_MAX_BLOCK_NUMBER;
+      return m_w2->get_transfer_details(lo + num_outputs - 1).m_block_height;
+    }, [&](uint64_t window_start, uint64_t window_end) {
+      tx_query->m_min_height = window_start;
+      tx_query->m_max_height = window_end;
+      return get_outputs(*_query);
+    });
+    return page;
+  }
+
   std::string monero_wallet_core::get_outputs_hex() const {
     return epee::string_tools::buff_to_hex_nodelimer(m_w2->export_outputs_to_str(true));
   }
@@ -1566,7 +2128,11 @@ namespace monero {
     }
 
     // import hex and return result
-    return m_w2->import_outputs_from_str(blob);
+    w2_write_lock lock(*this);
+    int num_imported = m_w2->import_outputs_from_str(blob);
+    m_tx_index->invalidate();
+    m_balance_tracker->invalidate();
+    return num_imported;
   }
 
   std::vector<std::shared_ptr<monero_key_image>> monero_wallet_core::get_key_images() const {
@@ -1578,7 +2144,7 @@ namespace monero {
     for (size_t n = 0; n < ski.second.size(); ++n) {
       std::shared_ptr<monero_key_image> key_image = std::make_shared<monero_key_image>();
       key_images.push_back(key_image);
-      key_image->m_hex = epee::string_tools::pod_to_hex(ski.second[n].first);
+      key_image->m_hex = monero_lazy_hex::from_pod(ski.second[n].first);
       key_image->m_signature = epee::string_tools::pod_to_hex(ski.second[n].second);
     }
     return key_images;
@@ -1591,7 +2157,7 @@ namespace monero {
     std::vector<std::pair<crypto::key_image, crypto::signature>> ski;
     ski.resize(key_images.size());
     for (size_t n = 0; n < ski.size(); ++n) {
-      if (!epee::string_tools::hex_to_pod(key_images[n]->m_hex.get(), ski[n].first)) {
+      if (!key_images[n]->m_hex.get_pod(ski[n].first)) {
         throw std::runtime_error("failed to parse key image");
       }
       if (!epee::string_tools::hex_to_pod(key_images[n]->m_signature.get(), ski[n].second)) {
@@ -1601,7 +2167,10 @@ namespace monero {
 
     // import key images
     uint64_t spent = 0, unspent = 0;
+    w2_write_lock lock(*this);
     uint64_t height = m_w2->import_key_images(ski, 0, spent, unspent, is_connected()); // TODO: use offset? refer to wallet_rpc_server::on_import_key_images() req.offset
+    m_tx_index->invalidate(); // spent checks can add outgoing txs at any height
+    m_balance_tracker->invalidate();
 
     // translate results
     std::shared_ptr<monero_key_image_import_result> result = std::make_shared<monero_key_image_import_result>();
@@ -1611,6 +2180,12 @@ namespace monero {
     return result;
   }
 
+  std::future<std::vector<std::shared_ptr<monero_tx_wallet>>> monero_wallet_core::create_txs_async(const monero_tx_config& config) {
+    MTRACE("monero_wallet_core::create_txs_async");
+    monero_tx_config config_copy = config.copy();
+    return run_async<std::vector<std::shared_ptr<monero_tx_wallet>>>([this, config_copy]() { return create_txs(config_copy); });
+  }
+
   std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_core::create_txs(const monero_tx_config& config) {
     MTRACE("monero_wallet_core::create_txs");
     //std::cout << "monero_tx_config: " << config.serialize()  << std::endl;
@@ -1644,7 +2219,8 @@ namespace monero {
     std::set<uint32_t> subaddress_indices;
     for (const uint32_t& subaddress_idx : config.m_subaddress_indices) subaddress_indices.insert(subaddress_idx);
 
-    // prepare transactions
+    // prepare transactions while wallet2 state is exclusive, since wallet2 caches daemon data while creating txs and commit_tx() marks their inputs spent
+    w2_write_lock lock(*this);
     std::vector<wallet2::pending_tx> ptx_vector = m_w2->create_transactions_2(dsts, mixin, unlock_time, priority, extra, account_index, subaddress_indices);
     if (ptx_vector.empty()) throw std::runtime_error("No transaction created");
 
@@ -1672,6 +2248,7 @@ namespace monero {
     if (!fill_response(m_w2.get(), ptx_vector, get_tx_keys, tx_keys, tx_amounts, tx_fees, tx_weights, multisig_tx_hex, unsigned_tx_hex, !relay, tx_hashes, get_tx_hex, tx_blobs, get_tx_metadata, tx_metadatas, err)) {
       throw std::runtime_error("need to handle error filling response!");  // TODO
     }
+    if (relay) for (const tools::wallet2::pending_tx& ptx : ptx_vector) m_balance_tracker->mark_spent(ptx.tx); // committed txs spend their inputs
 
     // build sent txs from results  // TODO: break this into separate utility function
     std::vector<std::shared_ptr<monero_tx_wallet>> txs;
@@ -1835,7 +2412,8 @@ namespace monero {
     std::set<uint32_t> subaddress_indices;
     for (const uint32_t& subaddress_idx : config.m_subaddress_indices) subaddress_indices.insert(subaddress_idx);
 
-    // prepare transactions
+    // prepare transactions while wallet2 state is exclusive, since wallet2 caches daemon data while creating txs and commit_tx() marks their inputs spent
+    w2_write_lock lock(*this);
     std::vector<wallet2::pending_tx> ptx_vector = m_w2->create_transactions_all(below_amount, dsts[0].addr, dsts[0].is_subaddress, num_outputs, mixin, unlock_time, priority, extra, account_index, subaddress_indices);
 
     // config for fill_response()
@@ -1857,6 +2435,7 @@ namespace monero {
     if (!fill_response(m_w2.get(), ptx_vector, get_tx_keys, tx_keys, tx_amounts, tx_fees, tx_weights, multisig_tx_hex, unsigned_tx_hex, !relay, tx_hashes, get_tx_hex, tx_blobs, get_tx_metadata, tx_metadatas, err)) {
       throw std::runtime_error("need to handle error filling response!");  // TODO
     }
+    if (relay) for (const tools::wallet2::pending_tx& ptx : ptx_vector) m_balance_tracker->mark_spent(ptx.tx); // committed txs spend their inputs
 
     // build sent txs from results  // TODO: break this into separate utility function
     std::vector<std::shared_ptr<monero_tx_wallet>> txs;
@@ -1953,6 +2532,7 @@ namespace monero {
     uint64_t mixin = m_w2->adjust_mixin(0);
     uint32_t priority = m_w2->adjust_priority(config.m_priority == boost::none ? 0 : config.m_priority.get());
     uint64_t unlock_time = config.m_unlock_time == boost::none ? 0 : config.m_unlock_time.get();
+    w2_write_lock lock(*this); // exclusive while creating and committing as in create_txs()
     std::vector<wallet2::pending_tx> ptx_vector = m_w2->create_transactions_single(ki, dsts[0].addr, dsts[0].is_subaddress, 1, mixin, unlock_time, priority, extra);
 
     // validate created transaction
@@ -1980,6 +2560,7 @@ namespace monero {
     if (!fill_response(m_w2.get(), ptx_vector, get_tx_keys, tx_keys, tx_amounts, tx_fees, tx_weights, multisig_tx_hex, unsigned_tx_hex, !relay, tx_hashes, get_tx_hex, tx_blobs, get_tx_metadata, tx_metadatas, err)) {
       throw std::runtime_error("need to handle error filling response!");  // TODO: return err message
     }
+    if (relay) for (const tools::wallet2::pending_tx& ptx : ptx_vector) m_balance_tracker->mark_spent(ptx.tx); // committed txs spend their inputs
 
     // build sent txs from results  // TODO: use common utility with send_txs() to avoid code duplication
     std::vector<std::shared_ptr<monero_tx_wallet>> txs;
@@ -2050,6 +2631,7 @@ namespace monero {
     MTRACE("monero_wallet_core::sweep_dust()");
 
     // create transaction to fill
+    w2_write_lock lock(*this); // exclusive while creating and committing as in create_txs()
     std::vector<wallet2::pending_tx> ptx_vector = m_w2->create_unmixable_sweep_transactions();
 
     // config for fill_response
@@ -2071,6 +2653,7 @@ namespace monero {
     if (!fill_response(m_w2.get(), ptx_vector, get_tx_keys, tx_keys, tx_amounts, tx_fees, tx_weights, multisig_tx_hex, unsigned_tx_hex, !relay, tx_hashes, get_tx_hex, tx_blobs, get_tx_metadata, tx_metadatas, er)) {
       throw std::runtime_error("need to handle error filling response!");  // TODO: return err message
     }
+    if (relay) for (const tools::wallet2::pending_tx& ptx : ptx_vector) m_balance_tracker->mark_spent(ptx.tx); // committed txs spend their inputs
 
     // build sent txs from results  // TODO: use common utility with send_txs() to avoid code duplication
     std::vector<std::shared_ptr<monero_tx_wallet>> txs;
@@ -2132,11 +2715,17 @@ namespace monero {
     return txs;
   }
 
+  std::future<std::vector<std::string>> monero_wallet_core::relay_txs_async(const std::vector<std::string>& tx_metadatas) {
+    MTRACE("relay_txs_async()");
+    return run_async<std::vector<std::string>>([this, tx_metadatas]() { return relay_txs(tx_metadatas); });
+  }
+
   std::vector<std::string> monero_wallet_core::relay_txs(const std::vector<std::string>& tx_metadatas) {
     MTRACE("relay_txs()");
 
     // relay each metadata as a tx
     std::vector<std::string> tx_hashes;
+    w2_write_lock lock(*this); // commit_tx() marks inputs spent
     for (const auto& txMetadata : tx_metadatas) {
 
       // parse tx metadata hex
@@ -2161,6 +2750,7 @@ namespace monero {
       } catch (const std::exception& e) {
         throw std::runtime_error("Failed to commit tx");
       }
+      m_balance_tracker->mark_spent(ptx.tx);
 
       // collect resulting hash
       tx_hashes.push_back(epee::string_tools::pod_to_hex(cryptonote::get_transaction_hash(ptx.tx)));
@@ -2240,13 +2830,13 @@ namespace monero {
             {
               if (payment_id8 != crypto::null_hash8)
               {
-                tx->m_payment_id = epee::string_tools::pod_to_hex(payment_id8);
+                tx->m_payment_id = monero_lazy_hex::from_pod(payment_id8);
                 has_encrypted_payment_id = true;
               }
             }
             else if (cryptonote::get_payment_id_from_tx_extra_nonce(extra_nonce.nonce, payment_id))
             {
-              tx->m_payment_id = epee::string_tools::pod_to_hex(payment_id);
+              tx->m_payment_id = monero_lazy_hex::from_pod(payment_id);
             }
           }
         }
@@ -2366,8 +2956,10 @@ namespace monero {
 
     try {
       std::vector<std::string> tx_hashes;
+      w2_write_lock lock(*this); // commit_tx() marks inputs spent
       for (auto &ptx: ptx_vector) {
         m_w2->commit_tx(ptx);
+        m_balance_tracker->mark_spent(ptx.tx);
         tx_hashes.push_back(epee::string_tools::pod_to_hex(cryptonote::get_transaction_hash(ptx.tx)));
       }
       return tx_hashes;
@@ -2611,6 +3203,7 @@ namespace monero {
       throw std::runtime_error("TX hash has invalid format");
     }
     crypto::hash _tx_hash = *reinterpret_cast<const crypto::hash*>(tx_blob.data());
+    w2_write_lock lock(*this);
     m_w2->set_tx_note(_tx_hash, note);
   }
 
@@ -2915,7 +3508,13 @@ namespace monero {
     }
 
     // import peer multisig hex
-    int num_outputs = m_w2->import_multisig(multisig_blobs);
+    int num_outputs;
+    {
+      w2_write_lock lock(*this);
+      num_outputs = m_w2->import_multisig(multisig_blobs);
+      m_tx_index->invalidate();
+      m_balance_tracker->invalidate();
+    }
 
     // if daemon is trusted, rescan spent
     if (is_daemon_trusted()) rescan_spent();
@@ -2995,8 +3594,10 @@ namespace monero {
     // commit the transactions
     std::vector<std::string> tx_hashes;
     try {
+      w2_write_lock lock(*this); // commit_tx() marks inputs spent
       for (auto& pending_tx : signed_multisig_tx_set.m_ptx) {
         m_w2->commit_tx(pending_tx);
+        m_balance_tracker->mark_spent(pending_tx.tx);
         tx_hashes.push_back(epee::string_tools::pod_to_hex(cryptonote::get_transaction_hash(pending_tx.tx)));
       }
     } catch (const std::exception& e) {
@@ -3016,6 +3617,8 @@ namespace monero {
   void monero_wallet_core::move_to(std::string path, std::string password) {
     MTRACE("move_to(" << path << ", ***)");
     m_w2->store_to(path, password);
+    boost::lock_guard<boost::mutex> guarg(m_subaddress_index_mutex);
+    if (m_subaddress_index.is_initialized()) m_subaddress_index.save(monero_subaddress_index::get_path(path));
   }
 
   std::string monero_wallet_core::get_keys_file_buffer(const epee::wipeable_string& password, bool view_only) const {
@@ -3032,32 +3635,132 @@ namespace monero {
     return buf;
   }
 
+  void monero_wallet_core::build_subaddress_index(uint32_t num_accounts, uint32_t num_subaddresses) {
+    MTRACE("build_subaddress_index(" << num_accounts << ", " << num_subaddresses << ")");
+    monero_subaddress_index subaddress_index;
+    subaddress_index.build(m_w2->get_account().get_keys(), m_w2->get_account().get_device(), num_accounts, num_subaddresses);
+    if (!m_w2->path().empty()) subaddress_index.save(monero_subaddress_index::get_path(m_w2->path()));
+    boost::lock_guard<boost::mutex> guarg(m_subaddress_index_mutex);
+    m_subaddress_index = std::move(subaddress_index);
+  }
+
+  uint64_t monero_wallet_core::restore_from_checkpoint(const std::string& checkpoint, const std::string& password) {
+    MTRACE("restore_from_checkpoint(...)");
+    if (get_height() > 1) throw std::runtime_error("Checkpoint can only be restored before the wallet syncs");
+
+    // load checkpoint with this wallet's keys before locking wallet2, which fails if the checkpoint belongs to another wallet
+    std::string keys_data = get_keys_file_buffer(password, m_w2->watch_only());
+    tools::wallet2 checkpoint_w2(m_w2->nettype(), 1, true);
+    try {
+      checkpoint_w2.load("", password, keys_data, checkpoint);
+    } catch (std::exception& e) {
+      throw std::runtime_error(std::string("Invalid checkpoint for wallet: ") + e.what());
+    }
+
+    // outputs without key images (e.g. from a view-only twin) cannot detect spends, so only skip to the first output
+    bool has_key_images = true;
+    uint64_t first_output_height = checkpoint_w2.get_blockchain_current_height();
+    for (size_t i = 0; i < checkpoint_w2.get_num_transfer_details(); i++) {
+      const tools::wallet2::transfer_details& td = checkpoint_w2.get_transfer_details(i);
+      if (!td.m_key_image_known) has_key_images = false;
+      first_output_height = std::min(first_output_height, td.m_block_height);
+    }
+    bool is_adopted = has_key_images || m_w2->watch_only();
+
+    // validate and apply the checkpoint while wallet2 is exclusive
+    boost::optional<monero_rpc_connection> daemon_connection = get_daemon_connection();
+    uint64_t height;
+    {
+      w2_write_lock lock(*this);
+      if (m_w2->get_blockchain_current_height() > 1) throw std::runtime_error("Checkpoint can only be restored before the wallet syncs"); // synced while loading
+      uint64_t restore_height = m_w2->get_refresh_from_block_height();
+      if (checkpoint_w2.get_refresh_from_block_height() > restore_height) throw std::runtime_error("Checkpoint starts above the wallet's restore height");
+      if (!is_adopted) {
+        m_w2->set_refresh_from_block_height(std::max(restore_height, first_output_height));
+        return m_w2->get_refresh_from_block_height();
+      }
+
+      // otherwise adopt the checkpoint's state and keep the wallet's files
+      std::string path = m_w2->path();
+      m_w2->load("", password, keys_data, checkpoint);
+      if (!path.empty()) m_w2->store_to(path, password);
+      m_tx_index->invalidate();
+      m_balance_tracker->invalidate();
+      height = m_w2->get_blockchain_current_height();
+    }
+
+    // reconnect to the daemon, which the loaded state does not include, once wallet2 is released
+    set_daemon_connection(daemon_connection);
+    return height;
+  }
+
   void monero_wallet_core::close(bool save) {
     MTRACE("close()");
     stop_syncing(); // prevent sync thread from starting again
+
+    // wait for running async operations and drop queued ones, which breaks their futures
+    std::vector<uint64_t> async_task_ids;
+    {
+      boost::lock_guard<boost::mutex> guarg(m_async_mutex);
+      for (const auto& async_task : m_async_tasks) async_task_ids.push_back(async_task.second);
+      m_async_tasks.clear();
+    }
+    for (uint64_t async_task_id : async_task_ids) monero_sync_scheduler::get_async_instance().remove(async_task_id);
     if (save) this->save();
-    if (m_sync_loop_running) {
-      m_sync_cv.notify_one();
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));  // TODO: in emscripten, m_sync_cv.notify_one() returns without waiting, so sleep; bug in emscripten upstream llvm?
-      m_syncing_thread.join();
+    bool is_sync_loop_running;
+    {
+      boost::lock_guard<boost::mutex> guarg(m_sync_loop_mutex);
+      m_syncing_enabled = false;
+      is_sync_loop_running = m_sync_loop_running;
+    }
+    if (is_sync_loop_running) {
+      monero_sync_scheduler::get_instance().remove(m_sync_task_id);  // waits for a running sync step, which takes m_sync_loop_mutex
+      m_sync_loop_running = false;
     }
     m_w2->stop();
     m_w2->deinit();
     m_w2->callback(nullptr);  // unregister listener after sync
   }
 
+  void monero_wallet_core::set_daemon_status_ttl(uint64_t ttl_ms) {
+    m_daemon_status_ttl = ttl_ms;
+  }
+
+  uint64_t monero_wallet_core::get_daemon_status_ttl() const {
+    return m_daemon_status_ttl;
+  }
+
+  void monero_wallet_core::set_listener_batch_interval(uint64_t interval_ms) {
+    m_listener_batch_interval = interval_ms;
+  }
+
   // ------------------------------- PRIVATE HELPERS ----------------------------
 
   void monero_wallet_core::init_common() {
     MTRACE("monero_wallet_core.cpp init_common()");
+    m_w2_waiting = 0;
+    m_w2_entered = 0;
+    m_tx_index = std::unique_ptr<monero_tx_index>(new monero_tx_index(*m_w2));
+    m_balance_tracker = std::unique_ptr<monero_balance_tracker>(new monero_balance_tracker(*m_w2));
+    if (!m_w2->path().empty()) m_subaddress_index.load(monero_subaddress_index::get_path(m_w2->path()), m_w2->get_account().get_keys());
+    m_listener_batch_interval = 0;
     m_w2_listener = std::unique_ptr<wallet2_listener>(new wallet2_listener(*this, *m_w2));
+    m_w2_listener->update_listening();
     if (get_daemon_connection() == boost::none) m_is_connected = false;
+    publish_balance_snapshot();
+    m_daemon_height = 0;
+    m_daemon_max_peer_height = 0;
+    m_daemon_status_ttl = DEFAULT_DAEMON_STATUS_TTL_MILLIS;
     m_prev_balance = get_balance();
     m_prev_unlocked_balance = get_unlocked_balance();
     m_is_synced = false;
     m_rescan_on_sync = false;
     m_syncing_enabled = false;
     m_sync_loop_running = false;
+    m_sync_task_id = 0;
+    m_sync_stopped_early = false;
+    m_sync_batch_ended = false;
+    m_next_async_key = 0;
     m_syncing_interval = DEFAULT_SYNC_INTERVAL_MILLIS;
 
     // emscripten config
@@ -3072,14 +3775,222 @@ namespace monero {
   }
 
   void monero_wallet_core::check_for_changed_balances() {
-    if (m_prev_balance != get_balance() || m_prev_unlocked_balance != get_unlocked_balance()) {
-      m_prev_balance = get_balance();
-      m_prev_unlocked_balance = get_unlocked_balance();
+    uint64_t balance = get_balance();
+    uint64_t unlocked_balance = get_unlocked_balance();
+    if (m_prev_balance != balance || m_prev_unlocked_balance != unlocked_balance) {
+      m_prev_balance = balance;
+      m_prev_unlocked_balance = unlocked_balance;
       m_w2_listener->on_balances_changed(m_prev_balance, m_prev_unlocked_balance);
     }
   }
 
-  std::vector<std::shared_ptr<monero_transfer>> monero_wallet_core::get_transfers_aux(const monero_transfer_query& query) const {
+  template <class T>
+  std::future<T> monero_wallet_core::run_async(const std::function<T()>& fn) {
+    std::shared_ptr<std::promise<T>> promise = std::make_shared<std::promise<T>>();
+    std::future<T> future = promise->get_future();
+    boost::lock_guard<boost::mutex> guarg(m_async_mutex);
+    uint64_t key = m_next_async_key++;
+    m_async_tasks[key] = monero_sync_scheduler::get_async_instance().add([this, fn, promise, key]() {
+      try {
+        promise->set_value(fn());
+      } catch (...) {
+        promise->set_exception(std::current_exception());
+      }
+      boost::lock_guard<boost::mutex> guarg(m_async_mutex);
+      m_async_tasks.erase(key);
+      return monero_sync_scheduler::STOP;
+    });
+    return future;
+  }
+
+  std::future<monero_sync_result> monero_wallet_core::sync_async_aux(boost::optional<uint64_t> start_height) {
+    std::shared_ptr<std::promise<monero_sync_result>> promise = std::make_shared<std::promise<monero_sync_result>>();
+    std::future<monero_sync_result> future = promise->get_future();
+    std::shared_ptr<monero_sync_result> result = std::make_shared<monero_sync_result>();
+    result->m_num_blocks_fetched = 0;
+    result->m_received_money = false;
+    std::shared_ptr<boost::optional<uint64_t>> step_start_height = std::make_shared<boost::optional<uint64_t>>(start_height);
+    boost::lock_guard<boost::mutex> guarg(m_async_mutex);
+    uint64_t key = m_next_async_key++;
+
+    // sync in bounded steps like the sync loop so a long sync does not hold an async worker
+    m_async_tasks[key] = monero_sync_scheduler::get_async_instance().add([this, promise, result, step_start_height, key]() -> uint64_t {
+      try {
+        if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
+        boost::unique_lock<boost::mutex> sync_lock(m_sync_mutex, boost::try_to_lock);
+        if (!sync_lock.owns_lock()) return ASYNC_SYNC_RETRY_MILLIS;
+        bool is_stopped_early = false;
+        monero_sync_result step_result = sync_with_lock(*step_start_height, std::chrono::steady_clock::now() + std::chrono::milliseconds(MAX_SYNC_STEP_MILLIS), &is_stopped_early);
+        result->m_num_blocks_fetched += step_result.m_num_blocks_fetched;
+        if (step_result.m_received_money) result->m_received_money = true;
+        if (is_stopped_early) {
+          *step_start_height = boost::none; // continue from the wallet's height
+          return 0;
+        }
+        promise->set_value(*result);
+      } catch (...) {
+        promise->set_exception(std::current_exception());
+      }
+      boost::lock_guard<boost::mutex> guarg(m_async_mutex);
+      m_async_tasks.erase(key);
+      return monero_sync_scheduler::STOP;
+    });
+    return future;
+  }
+
+  bool monero_wallet_core::is_daemon_status_fresh() const {
+    boost::lock_guard<boost::mutex> guarg(m_daemon_status_mutex);
+    return m_daemon_status_time != boost::none && std::chrono::steady_clock::now() - m_daemon_status_time.get() < std::chrono::milliseconds(m_daemon_status_ttl.load());
+  }
+
+  void monero_wallet_core::refresh_daemon_status(bool force) const {
+    if (!force && is_daemon_status_fresh()) return;
+    boost::lock_guard<boost::mutex> guarg(m_daemon_probe_mutex);
+    if (!force && is_daemon_status_fresh()) return; // probed while waiting
+
+    // probe connection outside the status lock so reads of the cache never wait on the daemon
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    uint32_t version = 0;
+    bool is_connected = m_w2->check_connection(&version, NULL, DEFAULT_CONNECTION_TIMEOUT_MILLIS);
+    //if (!m_w2->light_wallet() && (version >> 16) != CORE_RPC_VERSION_MAJOR) is_connected = false;  // wrong network type  // TODO: disallow rpc version mismatch by configuration
+
+    // probe heights
+    uint64_t height = 0;
+    uint64_t max_peer_height = 0;
+    if (is_connected) {
+      std::string err;
+      height = m_w2->get_daemon_blockchain_height(err);
+      if (!err.empty()) throw std::runtime_error(err);
+      max_peer_height = m_w2->get_daemon_blockchain_target_height(err);
+      if (!err.empty()) throw std::runtime_error(err);
+      if (max_peer_height == 0) max_peer_height = height;  // TODO monero core: target height can be 0 when daemon is synced.  Use blockchain height instead
+    }
+
+    // update cache
+    boost::lock_guard<boost::mutex> status_guarg(m_daemon_status_mutex);
+    m_is_connected = is_connected;
+    if (is_connected) {
+      m_daemon_height = height;
+      m_daemon_max_peer_height = max_peer_height;
+    }
+    m_daemon_status_time = now;
+  }
+
+  uint64_t monero_wallet_core::probe_daemon_height() const {
+
+    // probe the full status when stale
+    if (!is_daemon_status_fresh()) refresh_daemon_status();
+
+    // otherwise probe only the height
+    else {
+      boost::unique_lock<boost::mutex> probe_lock(m_daemon_probe_mutex);
+      std::string err;
+      uint64_t height = m_w2->get_daemon_blockchain_height(err);
+      if (err.empty()) {
+        boost::lock_guard<boost::mutex> status_guarg(m_daemon_status_mutex);
+        m_daemon_height = height;
+        if (m_daemon_max_peer_height < height) m_daemon_max_peer_height = height;
+      } else {
+        probe_lock.unlock();
+        refresh_daemon_status(true); // re-probe the connection
+      }
+    }
+
+    // return the cached height
+    boost::lock_guard<boost::mutex> guarg(m_daemon_status_mutex);
+    return m_is_connected ? m_daemon_height : 0;
+  }
+
+  bool monero_wallet_core::is_w2_locked_by_this_thread() const {
+    return t_w2_writer == this || std::find(t_w2_readers.begin(), t_w2_readers.end(), this) != t_w2_readers.end();
+  }
+
+  monero_wallet_core::w2_read_lock::w2_read_lock(const monero_wallet_core& wallet) : m_wallet(wallet), m_owns_lock(!wallet.is_w2_locked_by_this_thread()), m_is_readable(true) {
+    if (m_owns_lock) lock();
+  }
+
+  monero_wallet_core::w2_read_lock::w2_read_lock(const monero_wallet_core& wallet, boost::try_to_lock_t) : m_wallet(wallet), m_owns_lock(!wallet.is_w2_locked_by_this_thread()), m_is_readable(true) {
+    if (!m_owns_lock) return; // already locked on this thread
+    if (m_wallet.m_w2_mutex.try_lock_shared()) t_w2_readers.push_back(&m_wallet);
+    else if (std::atomic_load(&m_wallet.m_balance_snapshot) != nullptr) m_owns_lock = m_is_readable = false;
+    else lock(); // wait for sync if nothing is published
+  }
+
+  monero_wallet_core::w2_read_lock::~w2_read_lock() {
+    if (!m_owns_lock) return;
+    t_w2_readers.erase(std::find(t_w2_readers.begin(), t_w2_readers.end(), &m_wallet));
+    m_wallet.m_w2_mutex.unlock_shared();
+  }
+
+  void monero_wallet_core::w2_read_lock::lock() {
+    m_wallet.lock_w2(false);
+    t_w2_readers.push_back(&m_wallet);
+  }
+
+  void monero_wallet_core::lock_w2(bool is_exclusive) const {
+    if (is_exclusive ? m_w2_mutex.try_lock() : m_w2_mutex.try_lock_shared()) return;
+
+    // wait for sync to hand off at the end of its batch
+    {
+      boost::lock_guard<boost::mutex> guarg(m_w2_handoff_mutex);
+      m_w2_waiting++;
+    }
+    if (is_exclusive) m_w2_mutex.lock();
+    else m_w2_mutex.lock_shared();
+    {
+      boost::lock_guard<boost::mutex> guarg(m_w2_handoff_mutex);
+      m_w2_waiting--;
+      m_w2_entered++;
+    }
+    m_w2_handoff_cv.notify_all();
+  }
+
+  void monero_wallet_core::end_sync_batch_if_due() {
+    if (m_sync_batch_ended) return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (m_sync_deadline != boost::none && now >= *m_sync_deadline) m_sync_stopped_early = true;
+    else if (now - m_sync_batch_start < std::chrono::milliseconds(SYNC_HANDOFF_MILLIS) || (m_w2_waiting == 0 && !m_w2_listener->has_notifications())) return;
+    m_sync_batch_ended = true;
+    m_w2->stop(); // refresh returns once it commits the blocks it is processing
+  }
+
+  void monero_wallet_core::hand_off_w2() {
+    boost::unique_lock<boost::mutex> lock(m_w2_handoff_mutex);
+    uint64_t num_entered = m_w2_entered + m_w2_waiting;
+    while (m_w2_entered < num_entered) m_w2_handoff_cv.wait(lock);
+  }
+
+  monero_wallet_core::w2_write_lock::w2_write_lock(const monero_wallet_core& wallet) : m_wallet(wallet), m_owns_lock(t_w2_writer != &wallet) {
+    if (!m_owns_lock) return; // already exclusive on this thread
+    if (wallet.is_w2_locked_by_this_thread()) throw std::runtime_error("Cannot modify wallet while reading it on the same thread");
+    m_wallet.lock_w2(true);
+    t_w2_writer = &m_wallet;
+  }
+
+  monero_wallet_core::w2_write_lock::~w2_write_lock() {
+    if (!m_owns_lock) return;
+    m_wallet.m_balance_tracker->mark_unconfirmed_changed(); // e.g. committed, confirmed, or failed txs
+    try {
+      m_wallet.publish_balance_snapshot(); // reads while the next change holds wallet2 see this one, e.g. the previous sync batch
+    } catch (std::exception& e) {
+      MERROR("Failed to publish balance snapshot: " << e.what());
+    }
+    t_w2_writer = nullptr;
+    m_wallet.m_w2_mutex.unlock();
+    m_wallet.m_w2_listener->deliver_notifications(); // listeners may wait on queries, e.g. a full monero_async_listener whose delivery thread queries the wallet
+  }
+
+  void monero_wallet_core::publish_balance_snapshot() const {
+    std::shared_ptr<balance_snapshot> snapshot = std::make_shared<balance_snapshot>();
+    snapshot->m_height = m_w2->get_blockchain_current_height();
+    snapshot->m_balance = m_balance_tracker->get_balance();
+    snapshot->m_unlocked_balance = m_balance_tracker->get_unlocked_balance();
+    m_balance_tracker->get_balances(snapshot->m_subaddress_balances);
+    std::atomic_store(&m_balance_snapshot, std::shared_ptr<const balance_snapshot>(snapshot));
+  }
+
+
+  std::vector<std::shared_ptr<monero_transfer>> monero_wallet_core::get_transfers_aux(const monero_transfer_query& query, monero_result_arena* arena) const {
     MTRACE("monero_wallet_core::get_transfers(query)");
 
 //    // log query
@@ -3089,19 +4000,10 @@ namespace monero {
 //    } else std::cout << "Transfer query: " << query.serialize() << std::endl;
 
     // copy and normalize query
-    std::shared_ptr<monero_transfer_query> _query;
-    if (query.m_tx_query == boost::none) {
-      std::shared_ptr<monero_transfer_query> query_ptr = std::make_shared<monero_transfer_query>(query); // convert to shared pointer for copy  // TODO: does this copy unecessarily? copy constructor is not defined
-      _query = query_ptr->copy(query_ptr, std::make_shared<monero_transfer_query>());
-      _query->m_tx_query = std::make_shared<monero_tx_query>();
-      _query->m_tx_query.get()->m_transfer_query = _query;
-    } else {
-      std::shared_ptr<monero_tx_query> tx_query = query.m_tx_query.get()->copy(query.m_tx_query.get(), std::make_shared<monero_tx_query>());
-      _query = tx_query->m_transfer_query.get();
-    }
+    std::shared_ptr<monero_transfer_query> _query = copy_and_normalize(query);
     std::shared_ptr<monero_tx_query> tx_query = _query->m_tx_query.get();
 
-    // build parameters for m_w2->get_payments()
+    // build parameters for m_w2->get_payments() and the tx index
     uint64_t min_height = tx_query->m_min_height == boost::none ? 0 : *tx_query->m_min_height;
     uint64_t max_height = tx_query->m_max_height == boost::none ? CRYPTONOTE_MAX_BLOCK_NUMBER : std::min((uint64_t) CRYPTONOTE_MAX_BLOCK_NUMBER, *tx_query->m_max_height);
     if (min_height > 0) min_height--; // TODO monero core: wallet2::get_payments() m_min_height is exclusive, so manually offset to match intended range (issues 5751, #5598)
@@ -3111,6 +4013,13 @@ namespace monero {
     for (int i = 0; i < _query->m_subaddress_indices.size(); i++) {
       subaddress_indices.insert(_query->m_subaddress_indices[i]);
     }
+    monero_tx_index_query index_query;
+    index_query.m_min_height = min_height;
+    index_query.m_max_height = max_height;
+    index_query.m_account_index = account_index;
+    index_query.m_subaddress_indices = subaddress_indices;
+    index_query.m_tx_hashes = get_tx_hashes(*tx_query);
+    index_query.m_payment_ids = get_payment_ids(*tx_query);
 
     // check if pool txs explicitly requested without daemon connection
     if (tx_query->m_in_tx_pool != boost::none && tx_query->m_in_tx_pool.get() && !is_connected()) {
@@ -3130,26 +4039,26 @@ namespace monero {
 
     // cache unique txs and blocks
     uint64_t height = get_height();
-    std::map<std::string, std::shared_ptr<monero_tx_wallet>> tx_map;
-    std::map<uint64_t, std::shared_ptr<monero_block>> block_map;
+    monero_tx_map tx_map;
+    monero_block_map block_map;
 
     // get confirmed incoming transfers
     if (is_in) {
       std::list<std::pair<crypto::hash, tools::wallet2::payment_details>> payments;
-      m_w2->get_payments(payments, min_height, max_height, account_index, subaddress_indices);
+      m_tx_index->get_payments(payments, index_query);
       for (std::list<std::pair<crypto::hash, tools::wallet2::payment_details>>::const_iterator i = payments.begin(); i != payments.end(); ++i) {
-        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_incoming_transfer(*m_w2, height, i->first, i->second);
-        merge_tx(tx, tx_map, block_map, false);
+        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_incoming_transfer(*m_w2, height, i->first, i->second, arena);
+        merge_tx(i->second.m_tx_hash, tx, tx_map, block_map, false);
       }
     }
 
     // get confirmed outgoing transfers
     if (is_out) {
       std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>> payments;
-      m_w2->get_payments_out(payments, min_height, max_height, account_index, subaddress_indices);
+      m_tx_index->get_payments_out(payments, index_query);
       for (std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>>::const_iterator i = payments.begin(); i != payments.end(); ++i) {
-        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_outgoing_transfer(*m_w2, height, i->first, i->second);
-        merge_tx(tx, tx_map, block_map, false);
+        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_outgoing_transfer(*m_w2, height, i->first, i->second, arena);
+        merge_tx(i->first, tx, tx_map, block_map, false);
       }
     }
 
@@ -3158,36 +4067,34 @@ namespace monero {
       std::list<std::pair<crypto::hash, tools::wallet2::unconfirmed_transfer_details>> upayments;
       m_w2->get_unconfirmed_payments_out(upayments, account_index, subaddress_indices);
       for (std::list<std::pair<crypto::hash, tools::wallet2::unconfirmed_transfer_details>>::const_iterator i = upayments.begin(); i != upayments.end(); ++i) {
-        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_outgoing_transfer_unconfirmed(*m_w2, i->first, i->second);
+        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_outgoing_transfer_unconfirmed(*m_w2, i->first, i->second, arena);
         if (tx_query->m_is_failed != boost::none && tx_query->m_is_failed.get() != tx->m_is_failed.get()) continue; // skip merging if tx excluded
-        merge_tx(tx, tx_map, block_map, false);
+        merge_tx(i->first, tx, tx_map, block_map, false);
       }
     }
 
     // get unconfirmed incoming transfers
     if (is_pool) {
 
-      // update pool state TODO monero-core: this should be encapsulated in wallet when unconfirmed transfers queried
-      std::vector<std::tuple<cryptonote::transaction, crypto::hash, bool>> process_txs;
-      m_w2->update_pool_state(process_txs);
-      if (!process_txs.empty()) m_w2->process_pool_state(process_txs);
-
+      // pool state is updated by update_pool() before the query locks wallet2
       std::list<std::pair<crypto::hash, tools::wallet2::pool_payment_details>> payments;
       m_w2->get_unconfirmed_payments(payments, account_index, subaddress_indices);
       for (std::list<std::pair<crypto::hash, tools::wallet2::pool_payment_details>>::const_iterator i = payments.begin(); i != payments.end(); ++i) {
-        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_incoming_transfer_unconfirmed(*m_w2, i->first, i->second);
-        merge_tx(tx, tx_map, block_map, false);
+        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_incoming_transfer_unconfirmed(*m_w2, i->first, i->second, arena);
+        merge_tx(i->second.m_pd.m_tx_hash, tx, tx_map, block_map, false);
       }
     }
 
     // sort txs by block height
-    std::vector<std::shared_ptr<monero_tx_wallet>> txs ;
-    for (std::map<std::string, std::shared_ptr<monero_tx_wallet>>::const_iterator tx_iter = tx_map.begin(); tx_iter != tx_map.end(); tx_iter++) {
+    std::vector<std::shared_ptr<monero_tx_wallet>> txs;
+    txs.reserve(tx_map.size());
+    for (monero_tx_map::const_iterator tx_iter = tx_map.begin(); tx_iter != tx_map.end(); tx_iter++) {
       txs.push_back(tx_iter->second);
     }
     sort(txs.begin(), txs.end(), tx_height_less_than);
 
     // filter and return transfers
+    monero_transfer_query_plan plan(*_query);
     std::vector<std::shared_ptr<monero_transfer>> transfers;
     for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
 
@@ -3199,7 +4106,7 @@ namespace monero {
       sort(tx->m_incoming_transfers.begin(), tx->m_incoming_transfers.end(), incoming_transfer_before);
 
       // collect queried transfers, erase if excluded
-      for (const std::shared_ptr<monero_transfer>& transfer : tx->filter_transfers(*_query)) transfers.push_back(transfer);
+      for (const std::shared_ptr<monero_transfer>& transfer : tx->filter_transfers(plan)) transfers.push_back(transfer);
 
       // remove excluded txs from block
       if (tx->m_block != boost::none && tx->m_outgoing_transfer == boost::none && tx->m_incoming_transfers.empty()) {
@@ -3211,7 +4118,18 @@ namespace monero {
     return transfers;
   }
 
-  std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_core::get_outputs_aux(const monero_output_query& query) const {
+  void monero_wallet_core::update_pool(const monero_tx_query* tx_query) const {
+    if (!is_connected() || is_w2_locked_by_this_thread()) return; // nested queries read the pool state of the outer query
+    if (tx_query != nullptr && (bool_equals(true, tx_query->m_is_confirmed) || bool_equals(false, tx_query->m_in_tx_pool) || bool_equals(true, tx_query->m_is_failed) || bool_equals(false, tx_query->m_is_relayed) || tx_query->get_height() != boost::none || tx_query->m_min_height != boost::none)) return;
+
+    // update pool state exclusively so post-processing and queries read a consistent pool, and notifications are delivered once released TODO monero-core: this should be encapsulated in wallet when unconfirmed transfers queried
+    w2_write_lock lock(*this);
+    std::vector<std::tuple<cryptonote::transaction, crypto::hash, bool>> process_txs;
+    m_w2->update_pool_state(process_txs);
+    if (!process_txs.empty()) m_w2->process_pool_state(process_txs);
+  }
+
+  std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_core::get_outputs_aux(const monero_output_query& query, monero_result_arena* arena) const {
     MTRACE("monero_wallet_core::get_outputs_aux(query)");
 
 //    // log query
@@ -3221,44 +4139,29 @@ namespace monero {
 //    } else std::cout << "Output query: " << query.serialize() << std::endl;
 
     // copy and normalize query
-    std::shared_ptr<monero_output_query> _query;
-    if (query.m_tx_query == boost::none) {
-      std::shared_ptr<monero_output_query> query_ptr = std::make_shared<monero_output_query>(query); // convert to shared pointer for copy
-      _query = query_ptr->copy(query_ptr, std::make_shared<monero_output_query>());
-    } else {
-      std::shared_ptr<monero_tx_query> tx_query = query.m_tx_query.get()->copy(query.m_tx_query.get(), std::make_shared<monero_tx_query>());
-      if (query.m_tx_query.get()->m_output_query != boost::none && query.m_tx_query.get()->m_output_query.get().get() == &query) {
-        _query = tx_query->m_output_query.get();
-      } else {
-        if (query.m_tx_query.get()->m_output_query != boost::none) throw std::runtime_error("Output query's tx query must be a circular reference or null");
-        std::shared_ptr<monero_output_query> query_ptr = std::make_shared<monero_output_query>(query);  // convert query to shared pointer for copy
-        _query = query_ptr->copy(query_ptr, std::make_shared<monero_output_query>());
-        _query->m_tx_query = tx_query;
-      }
-    }
-    if (_query->m_tx_query == boost::none) _query->m_tx_query = std::make_shared<monero_tx_query>();
-
-    // get output data from wallet2
-    tools::wallet2::transfer_container outputs_w2;
-    m_w2->get_transfers(outputs_w2);
+    std::shared_ptr<monero_output_query> _query = copy_and_normalize(query);
 
-    // cache unique txs and blocks
-    std::map<std::string, std::shared_ptr<monero_tx_wallet>> tx_map;
-    std::map<uint64_t, std::shared_ptr<monero_block>> block_map;
-    for (const auto& output_w2 : outputs_w2) {
-      // TODO: skip tx building if m_w2 output excluded by indices, etc
-      std::shared_ptr<monero_tx_wallet> tx = build_tx_with_vout(*m_w2, output_w2);
-      merge_tx(tx, tx_map, block_map, false);
+    // cache unique txs and blocks of wallet2 outputs which can meet the query
+    transfer_details_filter filter(*_query);
+    monero_tx_map tx_map;
+    monero_block_map block_map;
+    for (size_t i = 0; i < m_w2->get_num_transfer_details(); i++) {
+      const tools::wallet2::transfer_details& output_w2 = m_w2->get_transfer_details(i);
+      if (!filter.meets_criteria(output_w2)) continue;
+      std::shared_ptr<monero_tx_wallet> tx = build_tx_with_vout(*m_w2, output_w2, arena);
+      merge_tx(output_w2.m_txid, tx, tx_map, block_map, false);
     }
 
     // sort txs by block height
-    std::vector<std::shared_ptr<monero_tx_wallet>> txs ;
-    for (std::map<std::string, std::shared_ptr<monero_tx_wallet>>::const_iterator tx_iter = tx_map.begin(); tx_iter != tx_map.end(); tx_iter++) {
+    std::vector<std::shared_ptr<monero_tx_wallet>> txs;
+    txs.reserve(tx_map.size());
+    for (monero_tx_map::const_iterator tx_iter = tx_map.begin(); tx_iter != tx_map.end(); tx_iter++) {
       txs.push_back(tx_iter->second);
     }
     sort(txs.begin(), txs.end(), tx_height_less_than);
 
     // filter and return outputs
+    monero_output_query_plan plan(*_query);
     std::vector<std::shared_ptr<monero_output_wallet>> outputs;
     for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
 
@@ -3266,7 +4169,7 @@ namespace monero {
       sort(tx->m_outputs.begin(), tx->m_outputs.end(), vout_before);
 
       // collect queried outputs, erase if excluded
-      for (const std::shared_ptr<monero_output_wallet>& output : tx->filter_outputs_wallet(*_query)) outputs.push_back(output);
+      for (const std::shared_ptr<monero_output_wallet>& output : tx->filter_outputs_wallet(plan)) outputs.push_back(output);
 
       // remove txs without outputs
       if (tx->m_outputs.empty() && tx->m_block != boost::none) tx->m_block.get()->m_txs.erase(std::remove(tx->m_block.get()->m_txs.begin(), tx->m_block.get()->m_txs.end(), tx), tx->m_block.get()->m_txs.end()); // TODO, no way to use const_iterator?
@@ -3274,13 +4177,38 @@ namespace monero {
     return outputs;
   }
 
-  // private helper to initialize subaddresses using transfer details
-  std::vector<monero_subaddress> monero_wallet_core::get_subaddresses_aux(const uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices, const std::vector<tools::wallet2::transfer_details>& transfers) const {
-    std::vector<monero_subaddress> subaddresses;
+  // private helper to aggregate subaddress state in one pass over transfers; caller holds w2_read_lock for the whole pass
+  void monero_wallet_core::get_subaddress_aggregates(const boost::optional<uint32_t>& account_idx, subaddress_aggregates& aggregates) const {
+
+    // collect outputs, usage, and blocks to unlock like wallet2::unlocked_balance_per_subaddress()
+    uint64_t height = m_w2->get_blockchain_current_height();
+    for (size_t idx = 0; idx < m_w2->get_num_transfer_details(); idx++) {
+      const tools::wallet2::transfer_details& td = m_w2->get_transfer_details(idx);
+      if (account_idx != boost::none && td.m_subaddr_index.major != *account_idx) continue;
+      subaddress_aggregate& aggregate = aggregates[std::make_pair(td.m_subaddr_index.major, td.m_subaddr_index.minor)];
+      aggregate.m_is_used = true;
+      if (td.m_spent) continue;
+      aggregate.m_num_unspent_outputs++;
+      if (td.m_frozen) continue;
+      uint64_t unlock_height = td.m_block_height + std::max<uint64_t>(CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE, CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS);
+      if (td.m_tx.unlock_time < CRYPTONOTE_MAX_BLOCK_NUMBER && td.m_tx.unlock_time > unlock_height) unlock_height = td.m_tx.unlock_time;
+      if (unlock_height > height) aggregate.m_num_blocks_to_unlock = std::max(aggregate.m_num_blocks_to_unlock, unlock_height - height);
+    }
 
-    // get balances per subaddress as maps
-    std::map<uint32_t, uint64_t> balance_per_subaddress = m_w2->balance_per_subaddress(account_idx, STRICT);
-    std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> unlocked_balance_per_subaddress = m_w2->unlocked_balance_per_subaddress(account_idx, STRICT);
+    // collect balances from tracker
+    std::map<std::pair<uint32_t, uint32_t>, std::pair<uint64_t, uint64_t>> balances;
+    m_balance_tracker->get_balances(balances);
+    for (const auto& entry : balances) {
+      if (account_idx != boost::none && entry.first.first != *account_idx) continue;
+      subaddress_aggregate& aggregate = aggregates[entry.first];
+      aggregate.m_balance = entry.second.first;
+      aggregate.m_unlocked_balance = entry.second.second;
+    }
+  }
+
+  // private helper to initialize subaddresses using aggregated subaddress state
+  std::vector<monero_subaddress> monero_wallet_core::get_subaddresses_aux(const uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices, const subaddress_aggregates& aggregates) const {
+    std::vector<monero_subaddress> subaddresses;
 
     // get all indices if no indices given
     std::vector<uint32_t> subaddress_indices_req;
@@ -3293,6 +4221,8 @@ namespace monero {
     }
 
     // initialize subaddresses at indices
+    const subaddress_aggregate empty_aggregate;
+    subaddresses.reserve(subaddress_indices_req.size());
     for (uint32_t subaddressIndicesIdx = 0; subaddressIndicesIdx < subaddress_indices_req.size(); subaddressIndicesIdx++) {
       monero_subaddress subaddress;
       subaddress.m_account_index = account_idx;
@@ -3300,14 +4230,13 @@ namespace monero {
       subaddress.m_index = subaddress_idx;
       subaddress.m_address = get_address(account_idx, subaddress_idx);
       subaddress.m_label = m_w2->get_subaddress_label({account_idx, subaddress_idx});
-      auto iter1 = balance_per_subaddress.find(subaddress_idx);
-      subaddress.m_balance = iter1 == balance_per_subaddress.end() ? 0 : iter1->second;
-      auto iter2 = unlocked_balance_per_subaddress.find(subaddress_idx);
-      subaddress.m_unlocked_balance = iter2 == unlocked_balance_per_subaddress.end() ? 0 : iter2->second.first;
-      cryptonote::subaddress_index index = {account_idx, subaddress_idx};
-      subaddress.m_num_unspent_outputs = count_if(transfers.begin(), transfers.end(), [&](const tools::wallet2::transfer_details& td) { return !td.m_spent && td.m_subaddr_index == index; });
-      subaddress.m_is_used = find_if(transfers.begin(), transfers.end(), [&](const tools::wallet2::transfer_details& td) { return td.m_subaddr_index == index; }) != transfers.end();
-      subaddress.m_num_blocks_to_unlock = iter1 == balance_per_subaddress.end() ? 0 : iter2->second.second.first;
+      auto iter = aggregates.find(std::make_pair(account_idx, subaddress_idx));
+      const subaddress_aggregate& aggregate = iter == aggregates.end() ? empty_aggregate : iter->second;
+      subaddress.m_balance = aggregate.m_balance;
+      subaddress.m_unlocked_balance = aggregate.m_unlocked_balance;
+      subaddress.m_num_unspent_outputs = aggregate.m_num_unspent_outputs;
+      subaddress.m_is_used = aggregate.m_is_used;
+      subaddress.m_num_blocks_to_unlock = aggregate.m_num_blocks_to_unlock;
       subaddresses.push_back(subaddress);
     }
 
@@ -3315,35 +4244,70 @@ namespace monero {
   }
 
   void monero_wallet_core::run_sync_loop() {
-    if (m_sync_loop_running) return;  // only run one loop at a time
+    if (m_sync_loop_running) return;  // only run one loop at a time; caller holds m_sync_loop_mutex
     m_sync_loop_running = true;
+    m_sync_backoff = 1;
+    m_sync_last_daemon_height = 0;
+    m_sync_last_time = std::chrono::steady_clock::time_point();
 
-    // start sync loop thread
-    m_syncing_thread = boost::thread([this]() {
+    // schedule sync loop on the shared sync workers
+    m_sync_task_id = monero_sync_scheduler::get_instance().add([this]() { return sync_loop_step(); });
+  }
 
-      // sync while enabled
-      while (m_syncing_enabled) {
-        try {
-          lock_and_sync();
-        } catch (...) {
-          std::cout << "monero_wallet_core failed to background synchronize" << std::endl;
-        }
+  uint64_t monero_wallet_core::sync_loop_step() {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    std::uniform_real_distribution<double> jitter(1 - SYNC_INTERVAL_JITTER, 1 + SYNC_INTERVAL_JITTER);
 
-        // only wait if syncing still enabled
-        if (m_syncing_enabled) {
-          boost::mutex::scoped_lock lock(m_syncing_mutex);
-          boost::posix_time::milliseconds wait_for_ms(m_syncing_interval.load());
-          m_sync_cv.timed_wait(lock, wait_for_ms);
-        }
+    // stop if syncing disabled
+    {
+      boost::lock_guard<boost::mutex> guarg(m_sync_loop_mutex);
+      if (!m_syncing_enabled) {
+        m_sync_loop_running = false;
+        return monero_sync_scheduler::STOP;
       }
+    }
 
-      m_sync_loop_running = false;
-    });
+    try {
+
+      // probe the daemon height every interval so new blocks are synced promptly
+      uint64_t daemon_height = probe_daemon_height();
+
+      // while the chain is idle, back off the full sync which refreshes the pool
+      bool is_idle = m_is_synced && !m_rescan_on_sync && daemon_height == m_sync_last_daemon_height && get_height() >= daemon_height;
+      bool is_due = std::chrono::steady_clock::now() - m_sync_last_time >= std::chrono::milliseconds(static_cast<int64_t>(m_syncing_interval.load()) * m_sync_backoff);
+      if (!is_idle || is_due) {
+
+        // retry later instead of holding the worker while another sync runs, e.g. sync() or sync_async()
+        boost::unique_lock<boost::mutex> sync_lock(m_sync_mutex, boost::try_to_lock);
+        if (!sync_lock.owns_lock()) return static_cast<uint64_t>(m_syncing_interval.load() * jitter(rng));
+
+        // sync for a bounded time so long (re)scans share the workers, continuing behind other due wallets
+        bool is_stopped_early = false;
+        sync_with_lock(boost::none, std::chrono::steady_clock::now() + std::chrono::milliseconds(MAX_SYNC_STEP_MILLIS), &is_stopped_early);
+        m_sync_last_daemon_height = daemon_height;
+        m_sync_last_time = std::chrono::steady_clock::now();
+        m_sync_backoff = is_idle ? std::min(m_sync_backoff * 2, MAX_SYNC_BACKOFF) : 1;
+        if (is_stopped_early) return 0;
+      }
+    } catch (...) {
+      std::cout << "monero_wallet_core failed to background synchronize" << std::endl;
+      m_sync_last_time = std::chrono::steady_clock::now(); // retry the full sync after the backoff
+      m_sync_backoff = std::min(m_sync_backoff * 2, MAX_SYNC_BACKOFF);
+    }
+
+    // wait for next step
+    return static_cast<uint64_t>(m_syncing_interval.load() * jitter(rng));
   }
 
-  monero_sync_result monero_wallet_core::lock_and_sync(boost::optional<uint64_t> start_height) {
-    bool rescan = m_rescan_on_sync.exchange(false);
+  monero_sync_result monero_wallet_core::lock_and_sync(boost::optional<uint64_t> start_height, boost::optional<std::chrono::steady_clock::time_point> deadline, bool* is_stopped_early) {
     boost::lock_guard<boost::mutex> guarg(m_sync_mutex); // synchronize sync() and syncAsync()
+    return sync_with_lock(start_height, deadline, is_stopped_early);
+  }
+
+  monero_sync_result monero_wallet_core::sync_with_lock(boost::optional<uint64_t> start_height, boost::optional<std::chrono::steady_clock::time_point> deadline, bool* is_stopped_early) {
+    bool rescan = m_rescan_on_sync.exchange(false);
+    m_sync_deadline = deadline;
+    m_sync_stopped_early = false;
     monero_sync_result result;
     result.m_num_blocks_fetched = 0;
     result.m_received_money = false;
@@ -3352,12 +4316,19 @@ namespace monero {
       if (m_is_connected && is_daemon_synced()) {
 
         // rescan blockchain if requested
-        if (rescan) m_w2->rescan_blockchain(false);
+        if (rescan) {
+          w2_write_lock lock(*this);
+          m_w2->rescan_blockchain(false);
+          m_tx_index->invalidate();
+          m_balance_tracker->invalidate();
+        }
 
         // sync wallet
         result = sync_aux(start_height);
       }
     } while (!rescan && (rescan = m_rescan_on_sync.exchange(false))); // repeat if not rescanned and rescan was requested
+    m_sync_deadline = boost::none;
+    if (is_stopped_early != nullptr) *is_stopped_early = m_sync_stopped_early;
     return result;
   }
 
@@ -3372,18 +4343,54 @@ namespace monero {
     m_w2_listener->on_sync_start(sync_start_height);
     monero_sync_result result;
 
-    // attempt to refresh wallet2 which may throw exception
-    try {
-      m_w2->refresh(m_w2->is_trusted_daemon(), sync_start_height, result.m_num_blocks_fetched, result.m_received_money, true);
-      if (!m_is_synced) m_is_synced = true;
-      m_w2_listener->update_listening();  // cannot unregister during sync which would segfault
-    } catch (std::exception& e) {
-      m_w2_listener->on_sync_end(); // signal end of sync to reset listener's start and end heights
-      throw;
+    // refresh in batches which exclude queries while wallet2 state changes; wallet2 is idle between batches, where waiting queries run and listeners are notified
+    result.m_num_blocks_fetched = 0;
+    result.m_received_money = false;
+    while (true) {
+      m_sync_batch_start = std::chrono::steady_clock::now();
+      m_sync_batch_ended = false;
+      {
+        w2_write_lock lock(*this);
+
+        // attempt to refresh wallet2 which may throw exception; wallet2 fetches the next blocks while detecting outputs on the thread pool and commits blocks in order
+        try {
+          uint64_t num_blocks_fetched = 0;
+          bool received_money = false;
+          m_w2->refresh(m_w2->is_trusted_daemon(), sync_start_height, num_blocks_fetched, received_money, true);
+          result.m_num_blocks_fetched += num_blocks_fetched;
+          if (received_money) result.m_received_money = true;
+        } catch (std::exception& e) {
+          m_w2_listener->on_sync_end(); // signal end of sync to reset listener's start and end heights
+          throw;
+        }
+      }
+      if (!m_sync_batch_ended || m_sync_stopped_early) break;
+      hand_off_w2(); // let waiting queries in before the next batch
     }
+    if (!m_is_synced && !m_sync_stopped_early) m_is_synced = true;
+
+    // post-process committed blocks concurrently while queries proceed
+    {
+      w2_read_lock lock(*this);
+      tools::threadpool& tpool = tools::threadpool::getInstance();
+      tools::threadpool::waiter waiter(tpool);
+
+      // update tx index with (re)processed blocks if built
+      if (m_tx_index->is_initialized()) tpool.submit(&waiter, [this]() { m_tx_index->update(); });
 
-    // find and save rings
-    m_w2->find_and_save_rings(false);
+      // find and save rings
+      try {
+        m_w2->find_and_save_rings(false);
+      } catch (std::exception& e) {
+        waiter.wait();
+        m_w2_listener->on_sync_end();
+        throw;
+      }
+      if (!waiter.wait()) {
+        m_tx_index->invalidate(); // rebuild on next query
+        MWARNING("Failed to update tx index after sync");
+      }
+    }
 
     // notify listeners of sync end and check for updated balances
     m_w2_listener->on_sync_end();
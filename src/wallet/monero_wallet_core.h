@@ -53,9 +53,14 @@
 #pragma once
 
 #include "monero_wallet.h"
+#include "monero_tx_index.h"
+#include "monero_balance_tracker.h"
+#include "monero_subaddress_index.h"
+#include "monero_sync_scheduler.h"
 #include "wallet/wallet2.h"
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/condition_variable.hpp>
 
@@ -203,6 +208,8 @@ namespace monero {
     monero_sync_result sync(monero_wallet_listener& listener) override;
     monero_sync_result sync(uint64_t start_height) override;
     monero_sync_result sync(uint64_t start_height, monero_wallet_listener& listener) override;
+    std::future<monero_sync_result> sync_async() override;
+    std::future<monero_sync_result> sync_async(uint64_t start_height) override;
     void start_syncing() override;
     void stop_syncing() override;
     void rescan_spent() override;
@@ -221,17 +228,24 @@ namespace monero {
     std::vector<std::shared_ptr<monero_tx_wallet>> get_txs() const override;
     std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(const monero_tx_query& query) const override;
     std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(const monero_tx_query& query, std::vector<std::string>& missing_tx_hashes) const override;
+    std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(const monero_tx_query& query, monero_result_arena& arena) const override;
     std::vector<std::shared_ptr<monero_transfer>> get_transfers(const monero_transfer_query& query) const override;
+    std::vector<std::shared_ptr<monero_transfer>> get_transfers(const monero_transfer_query& query, monero_result_arena& arena) const override;
+    monero_transfer_page get_transfers_page(const monero_transfer_query& query, const monero_page_cursor& cursor, uint32_t limit) const override;
     std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(const monero_output_query& query) const override;
+    std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(const monero_output_query& query, monero_result_arena& arena) const override;
+    monero_output_page get_outputs_page(const monero_output_query& query, const monero_page_cursor& cursor, uint32_t limit) const override;
     std::string get_outputs_hex() const override;
     int import_outputs_hex(const std::string& outputs_hex) override;
     std::vector<std::shared_ptr<monero_key_image>> get_key_images() const override;
     std::shared_ptr<monero_key_image_import_result> import_key_images(const std::vector<std::shared_ptr<monero_key_image>>& key_images) override;
     std::vector<std::shared_ptr<monero_tx_wallet>> create_txs(const monero_tx_config& config) override;
+    std::future<std::vector<std::shared_ptr<monero_tx_wallet>>> create_txs_async(const monero_tx_config& config) override;
     std::vector<std::shared_ptr<monero_tx_wallet>> sweep_unlocked(const monero_tx_config& config) override;
     std::shared_ptr<monero_tx_wallet> sweep_output(const monero_tx_config& config) override;
     std::vector<std::shared_ptr<monero_tx_wallet>> sweep_dust(bool relay = false) override;
     std::vector<std::string> relay_txs(const std::vector<std::string>& tx_metadatas) override;
+    std::future<std::vector<std::string>> relay_txs_async(const std::vector<std::string>& tx_metadatas) override;
     monero_tx_set parse_tx_set(const monero_tx_set& tx_set) override;
     std::string sign_txs(const std::string& unsigned_tx_hex) override;
     std::vector<std::string> submit_txs(const std::string& signed_tx_hex) override;
@@ -280,6 +294,58 @@ namespace monero {
     std::string get_keys_file_buffer(const epee::wipeable_string& password, bool view_only) const;
     std::string get_cache_file_buffer(const epee::wipeable_string& password) const;
 
+    /**
+     * Index subaddresses beyond wallet2's lookahead so get_address_index() resolves
+     * them in constant time.  The index is saved alongside the wallet if it has a path
+     * and is memory mapped when the wallet is opened.
+     *
+     * @param num_accounts is the number of accounts to index, starting from account 0
+     * @param num_subaddresses is the number of subaddresses to index per account
+     */
+    void build_subaddress_index(uint32_t num_accounts, uint32_t num_subaddresses);
+
+    /**
+     * Start a restored wallet from a checkpoint instead of rescanning from its restore height.
+     *
+     * The checkpoint is the cache of a wallet with the same keys synced to a known height,
+     * e.g. get_cache_file_buffer() of a synced sibling or view-only twin.  If the checkpoint
+     * has key images for its outputs (or this wallet is view-only), the wallet adopts its
+     * state and resumes syncing from the checkpoint height, verifying its block hashes
+     * against the daemon.  Otherwise the wallet only skips to the checkpoint's first
+     * received output, since the chain before it is proven empty for the wallet.
+     *
+     * @param checkpoint is the cache buffer to start from
+     * @param password is the wallet's password
+     * @return the height the wallet will sync from
+     */
+    uint64_t restore_from_checkpoint(const std::string& checkpoint, const std::string& password);
+
+    /**
+     * Set how long the cached daemon status is served before it is probed again.
+     *
+     * is_connected(), is_daemon_synced(), get_daemon_height(), and
+     * get_daemon_max_peer_height() read the connection status and heights from a
+     * cache which the sync loop refreshes in the background.  Reads only probe the
+     * daemon themselves once the cache is older than the TTL, and concurrent reads
+     * share the same probe.  The default TTL of 2 minutes outlasts the sync loop's
+     * longest default interval, so reads rarely probe while syncing is enabled.
+     *
+     * @param ttl_ms is the maximum age of the cached daemon status in milliseconds (0 to always probe)
+     */
+    void set_daemon_status_ttl(uint64_t ttl_ms);
+    uint64_t get_daemon_status_ttl() const;
+
+    /**
+     * Set how often received and spent outputs are dispatched to listeners while syncing.
+     *
+     * Outputs are collected into batches which share their tx and block graphs and are
+     * dispatched through on_outputs_received() and on_outputs_spent(), after which balances
+     * are checked once.  By default each block is one batch.
+     *
+     * @param interval_ms is the minimum time between batches in milliseconds (0 for one batch per block)
+     */
+    void set_listener_batch_interval(uint64_t interval_ms);
+
     // --------------------------------- PRIVATE --------------------------------
 
   private:
@@ -287,30 +353,118 @@ namespace monero {
     std::unique_ptr<tools::wallet2> m_w2;            // internal wallet implementation
     std::unique_ptr<wallet2_listener> m_w2_listener; // internal wallet implementation listener
     std::set<monero_wallet_listener*> m_listeners;   // external wallet listeners
+    std::unique_ptr<monero_tx_index> m_tx_index;     // index of confirmed tx history
+    std::unique_ptr<monero_balance_tracker> m_balance_tracker;  // balances maintained as transfers arrive, spend, and unlock
+    monero_subaddress_index m_subaddress_index;      // reverse lookup of subaddresses beyond the lookahead
+    mutable boost::mutex m_subaddress_index_mutex;   // synchronize lookups with rebuilding the subaddress index
 
     uint64_t m_prev_balance;
     uint64_t m_prev_unlocked_balance;
+    std::atomic<uint64_t> m_listener_batch_interval;  // minimum milliseconds between batches of output notifications
     void check_for_changed_balances();
 
     void init_common();
-    std::vector<monero_subaddress> get_subaddresses_aux(uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices, const std::vector<tools::wallet2::transfer_details>& transfers) const;
-    std::vector<std::shared_ptr<monero_transfer>> get_transfers_aux(const monero_transfer_query& query) const;
-    std::vector<std::shared_ptr<monero_output_wallet>> get_outputs_aux(const monero_output_query& query) const;
+
+    // shared lock on wallet2 state for a consistent read, which does not relock if this thread already reads or writes it
+    class w2_read_lock {
+    public:
+      w2_read_lock(const monero_wallet_core& wallet);  // wait for sync to hand off wallet2 state
+      w2_read_lock(const monero_wallet_core& wallet, boost::try_to_lock_t);  // do not wait for sync unless no balance snapshot is published to read instead
+      ~w2_read_lock();
+      bool is_readable() const { return m_is_readable; }  // false if sync holds wallet2 state
+    private:
+      const monero_wallet_core& m_wallet;
+      bool m_owns_lock;    // false if this thread already holds the lock
+      bool m_is_readable;  // whether this thread may read wallet2 state
+      void lock();
+    };
+    bool is_w2_locked_by_this_thread() const;    // whether this thread holds wallet2 state shared or exclusively
+
+    // exclusive lock on wallet2 state which marks this thread as its writer and delivers the listener notifications queued under it once released
+    class w2_write_lock {
+    public:
+      w2_write_lock(const monero_wallet_core& wallet);
+      ~w2_write_lock();
+    private:
+      const monero_wallet_core& m_wallet;
+      bool m_owns_lock;  // false if this thread already holds the lock
+    };
+
+    // balances and height published as each exclusive change to wallet2 commits, e.g. each sync batch, read instead of waiting for sync
+    struct balance_snapshot {
+      uint64_t m_height;
+      uint64_t m_balance;
+      uint64_t m_unlocked_balance;
+      std::map<std::pair<uint32_t, uint32_t>, std::pair<uint64_t, uint64_t>> m_subaddress_balances;  // balance and unlocked balance by account and subaddress index
+    };
+    mutable std::shared_ptr<const balance_snapshot> m_balance_snapshot;  // accessed with std::atomic_load() and std::atomic_store()
+    void publish_balance_snapshot() const;       // caller holds m_w2_mutex
+    std::vector<std::shared_ptr<monero_tx_wallet>> get_txs_aux(const monero_tx_query& query, std::vector<std::string>& missing_tx_hashes, monero_result_arena* arena) const;
+    std::vector<std::shared_ptr<monero_transfer>> get_transfers(const monero_transfer_query& query, monero_result_arena* arena) const;         // results are built in the arena if given
+    std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(const monero_output_query& query, monero_result_arena* arena) const;       // results are built in the arena if given
+
+    // per-subaddress state aggregated in one pass over wallet2's transfers
+    struct subaddress_aggregate {
+      bool m_is_used;
+      uint64_t m_num_unspent_outputs;
+      uint64_t m_num_blocks_to_unlock;
+      uint64_t m_balance;
+      uint64_t m_unlocked_balance;
+      subaddress_aggregate() : m_is_used(false), m_num_unspent_outputs(0), m_num_blocks_to_unlock(0), m_balance(0), m_unlocked_balance(0) {}
+    };
+    typedef std::map<std::pair<uint32_t, uint32_t>, subaddress_aggregate> subaddress_aggregates;  // by account and subaddress index
+    void get_subaddress_aggregates(const boost::optional<uint32_t>& account_idx, subaddress_aggregates& aggregates) const;  // aggregates all accounts if account index not given; caller holds w2_read_lock
+    std::vector<monero_subaddress> get_subaddresses_aux(uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices, const subaddress_aggregates& aggregates) const;
+    std::vector<std::shared_ptr<monero_transfer>> get_transfers_aux(const monero_transfer_query& query, monero_result_arena* arena) const;
+    std::vector<std::shared_ptr<monero_output_wallet>> get_outputs_aux(const monero_output_query& query, monero_result_arena* arena) const;
+    void update_pool(const monero_tx_query* tx_query) const;  // update wallet2's pool state before a query locks wallet2 if the tx query (all txs if null) can match pool txs
     std::vector<std::shared_ptr<monero_tx_wallet>> sweep_account(const monero_tx_config& config);  // sweeps unlocked funds within an account; private helper to sweep_unlocked()
 
     // blockchain sync management
     mutable std::atomic<bool> m_is_synced;       // whether or not wallet is synced
     mutable std::atomic<bool> m_is_connected;    // cache connection status to avoid unecessary RPC calls
-    boost::condition_variable m_sync_cv;         // to make sync threads woke
+    mutable boost::mutex m_daemon_status_mutex;  // synchronize reads and updates of the cached daemon status, never held while probing
+    mutable boost::mutex m_daemon_probe_mutex;   // serialize daemon status probes so concurrent reads share one
+    mutable uint64_t m_daemon_height;            // cached daemon height if connected
+    mutable uint64_t m_daemon_max_peer_height;   // cached daemon max peer height if connected
+    mutable boost::optional<std::chrono::steady_clock::time_point> m_daemon_status_time;  // when the daemon status was last probed, none if invalidated
+    std::atomic<uint64_t> m_daemon_status_ttl;   // max age of the cached daemon status in milliseconds
+    bool is_daemon_status_fresh() const;         // whether the cached daemon status is younger than the TTL
+    void refresh_daemon_status(bool force = false) const;  // probe the daemon status if stale or forced; caller must not hold m_daemon_status_mutex
+    uint64_t probe_daemon_height() const;        // probe the daemon height, or the full status if stale, and return the cached height, 0 if disconnected
     boost::mutex m_sync_mutex;                   // synchronize sync() and syncAsync() requests
+    mutable boost::shared_mutex m_w2_mutex;      // exclusive while syncing, rescanning, or updating the pool, shared while querying txs, transfers, and outputs
+    void lock_w2(bool is_exclusive) const;       // lock m_w2_mutex, counting this thread as waiting for sync's handoff if held
+    mutable std::atomic<uint32_t> m_w2_waiting;  // number of threads blocked on m_w2_mutex, which sync lets in between batches; updated under m_w2_handoff_mutex
+    mutable uint64_t m_w2_entered;               // number of blocked threads which acquired m_w2_mutex; guarded by m_w2_handoff_mutex
+    mutable boost::mutex m_w2_handoff_mutex;
+    mutable boost::condition_variable m_w2_handoff_cv;  // signals sync that blocked queries acquired m_w2_mutex
     std::atomic<bool> m_rescan_on_sync;          // whether or not to rescan on sync
-    std::atomic<bool> m_syncing_enabled;         // whether or not auto sync is enabled
-    std::atomic<bool> m_sync_loop_running;       // whether or not the syncing thread is shut down
+    boost::mutex m_sync_loop_mutex;              // synchronize enabling auto sync with the sync loop checking it
+    std::atomic<bool> m_syncing_enabled;         // whether or not auto sync is enabled; changed under m_sync_loop_mutex
+    std::atomic<bool> m_sync_loop_running;       // whether or not the sync loop is scheduled; changed under m_sync_loop_mutex
     std::atomic<int> m_syncing_interval;         // auto sync loop interval in milliseconds
-    boost::thread m_syncing_thread;              // thread for auto sync loop
-    boost::mutex m_syncing_mutex;                // synchronize auto sync loop
-    void run_sync_loop();                        // run the sync loop in a thread
-    monero_sync_result lock_and_sync(boost::optional<uint64_t> start_height = boost::none);  // internal function to synchronize request to sync and rescan
+    uint64_t m_sync_task_id;                     // id of the auto sync loop in the shared sync scheduler
+    uint64_t m_sync_last_daemon_height;          // daemon height when the auto sync loop last synced
+    int m_sync_backoff;                          // multiple of the sync interval between full syncs while the chain is idle
+    std::chrono::steady_clock::time_point m_sync_last_time;  // when the auto sync loop last synced
+    void run_sync_loop();                        // schedule the sync loop on the shared sync workers
+    uint64_t sync_loop_step();                   // run one step of the sync loop and return milliseconds until the next
+    boost::optional<std::chrono::steady_clock::time_point> m_sync_deadline;  // when the running sync stops after its current blocks, none if unbounded; guarded by m_sync_mutex
+    bool m_sync_stopped_early;                   // whether the running sync stopped at its deadline; guarded by m_sync_mutex
+    std::chrono::steady_clock::time_point m_sync_batch_start;  // when the running sync's batch locked wallet2; guarded by m_sync_mutex
+    bool m_sync_batch_ended;                     // whether the running sync's batch stopped wallet2 to hand off; guarded by m_sync_mutex
+    void end_sync_batch_if_due();                // stop refresh after its current blocks if queries, notifications, or the deadline are due; called from wallet2 on the sync thread
+    void hand_off_w2();                          // wait between batches until queries blocked on m_w2_mutex acquire it
+    monero_sync_result lock_and_sync(boost::optional<uint64_t> start_height = boost::none, boost::optional<std::chrono::steady_clock::time_point> deadline = boost::none, bool* is_stopped_early = nullptr);  // internal function to synchronize request to sync and rescan, stopping early after the deadline if given
+    monero_sync_result sync_with_lock(boost::optional<uint64_t> start_height, boost::optional<std::chrono::steady_clock::time_point> deadline, bool* is_stopped_early);  // lock_and_sync() once the caller holds m_sync_mutex
+
+    // async operations
+    boost::mutex m_async_mutex;                  // synchronize pending async operations
+    std::map<uint64_t, uint64_t> m_async_tasks;  // async scheduler task ids of pending async operations by key
+    uint64_t m_next_async_key;
+    template <class T> std::future<T> run_async(const std::function<T()>& fn);  // run an operation on the shared async workers, apart from sync loops
+    std::future<monero_sync_result> sync_async_aux(boost::optional<uint64_t> start_height);  // sync on the shared async workers in bounded steps
     monero_sync_result sync_aux(boost::optional<uint64_t> start_height = boost::none);       // internal function to immediately block, sync, and report progress
   };
 }
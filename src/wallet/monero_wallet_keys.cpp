@@ -61,6 +61,8 @@
 #include "cryptonote_basic/cryptonote_basic_impl.h"
 #include "string_tools.h"
 #include "device/device.hpp"
+#include "common/threadpool.h"
+#include "ringct/rctOps.h"
 
 using namespace epee;
 using namespace tools;
@@ -225,6 +227,71 @@ namespace monero {
     return cryptonote::get_account_address_as_str(static_cast<cryptonote::network_type>(m_network_type), !index.is_zero(), address);
   }
 
+  void monero_wallet_keys::get_addresses(const uint32_t account_idx, const uint32_t begin, const uint32_t end, std::vector<std::string>& addresses) const {
+    if (begin > end) throw std::runtime_error("Subaddress range begin must be <= end");
+    addresses.resize(end - begin);
+    if (begin == end) return;
+
+    // derive a chunk of addresses from the account's spend public key and view secret key, which the device shares across the chunk
+    hw::device &hwdev = m_account.get_device();
+    const cryptonote::account_keys& keys = m_account.get_keys();
+    const cryptonote::network_type network_type = static_cast<cryptonote::network_type>(m_network_type);
+    const rct::key view_secret_key = rct::sk2rct(keys.m_view_secret_key);
+    auto derive_chunk = [&](uint32_t chunk_begin, uint32_t chunk_end) {
+      std::vector<crypto::public_key> spend_public_keys = hwdev.get_subaddress_spend_public_keys(keys, account_idx, chunk_begin, chunk_end);
+      for (uint32_t subaddress_idx = chunk_begin; subaddress_idx < chunk_end; subaddress_idx++) {
+        std::string& address = addresses[subaddress_idx - begin];
+        if (account_idx == 0 && subaddress_idx == 0) {
+          address = m_primary_address;
+          continue;
+        }
+        cryptonote::account_public_address public_address;
+        public_address.m_spend_public_key = spend_public_keys[subaddress_idx - chunk_begin];
+        public_address.m_view_public_key = rct::rct2pk(rct::scalarmultKey(rct::pk2rct(public_address.m_spend_public_key), view_secret_key));
+        address = cryptonote::get_account_address_as_str(network_type, true, public_address);
+      }
+    };
+
+    // hardware devices are not thread safe so derive serially
+    tools::threadpool& tpool = tools::threadpool::getInstance();
+    const uint32_t num_addresses = end - begin;
+    uint32_t num_chunks = std::min<uint32_t>(tpool.get_max_concurrency(), (num_addresses + ADDRESS_CHUNK_SIZE - 1) / ADDRESS_CHUNK_SIZE);
+    if (hwdev.get_type() != hw::device::device_type::SOFTWARE || num_chunks <= 1) {
+      derive_chunk(begin, end);
+      return;
+    }
+
+    // otherwise spread chunks over the thread pool
+    uint32_t chunk_size = (num_addresses + num_chunks - 1) / num_chunks;
+    tools::threadpool::waiter waiter(tpool);
+    for (uint32_t chunk_begin = begin; chunk_begin < end; ) {
+      uint32_t chunk_end = chunk_begin + std::min(chunk_size, end - chunk_begin);
+      tpool.submit(&waiter, [&derive_chunk, chunk_begin, chunk_end]() { derive_chunk(chunk_begin, chunk_end); });
+      chunk_begin = chunk_end;
+    }
+    if (!waiter.wait()) throw std::runtime_error("Failed to derive subaddresses");
+  }
+
+  monero_subaddress monero_wallet_keys::get_address_index(const std::string& address) const {
+
+    // validate address
+    cryptonote::address_parse_info info;
+    if (!cryptonote::get_account_address_from_str(info, static_cast<cryptonote::network_type>(m_network_type), address)) {
+      throw std::runtime_error("Invalid address");
+    }
+
+    // get index of address in subaddress index
+    if (!m_subaddress_index.is_initialized()) throw std::runtime_error("Subaddress index is not built; call build_subaddress_index()");
+    boost::optional<cryptonote::subaddress_index> index = m_subaddress_index.find(info.address, m_account.get_keys(), m_account.get_device());
+    if (!index) throw std::runtime_error("Address doesn't belong to the wallet");
+
+    // return indices in subaddress
+    monero_subaddress subaddress;
+    subaddress.m_account_index = index->major;
+    subaddress.m_index = index->minor;
+    return subaddress;
+  }
+
   monero_integrated_address monero_wallet_keys::get_integrated_address(const std::string& standard_address, const std::string& payment_id) const {
     std::cout << "monero_wallet_keys::get_integrated_address()" << std::endl;
     throw std::runtime_error("monero_wallet_keys::get_integrated_address() not implemented");
@@ -284,6 +351,18 @@ namespace monero {
     throw std::runtime_error("monero_wallet_keys::verify_message() not implemented");
   }
 
+  void monero_wallet_keys::build_subaddress_index(uint32_t num_accounts, uint32_t num_subaddresses) {
+    m_subaddress_index.build(m_account.get_keys(), m_account.get_device(), num_accounts, num_subaddresses);
+  }
+
+  void monero_wallet_keys::save_subaddress_index(const std::string& path) const {
+    m_subaddress_index.save(path);
+  }
+
+  bool monero_wallet_keys::load_subaddress_index(const std::string& path) {
+    return m_subaddress_index.load(path, m_account.get_keys());
+  }
+
   void monero_wallet_keys::close(bool save) {
     if (save) throw std::runtime_error("MoneroWalletKeys does not support saving");
     // no pointers to destroy
@@ -53,6 +53,7 @@
 #pragma once
 
 #include "monero_wallet.h"
+#include "monero_subaddress_index.h"
 #include "cryptonote_basic/account.h"
 
 using namespace monero;
@@ -126,6 +127,8 @@ namespace monero {
     std::string get_public_spend_key() const override { return m_pub_spend_key; }
     std::string get_primary_address() const override { return m_primary_address; }
     std::string get_address(const uint32_t account_idx, const uint32_t subaddress_idx) const override;
+    void get_addresses(const uint32_t account_idx, const uint32_t begin, const uint32_t end, std::vector<std::string>& addresses) const override;
+    monero_subaddress get_address_index(const std::string& address) const override;
     monero_integrated_address get_integrated_address(const std::string& standard_address = "", const std::string& payment_id = "") const override;
     monero_integrated_address decode_integrated_address(const std::string& integrated_address) const override;
     monero_account get_account(const uint32_t account_idx, bool include_subaddresses) const override;
@@ -134,9 +137,35 @@ namespace monero {
     bool verify_message(const std::string& msg, const std::string& address, const std::string& signature) const override;
     void close(bool save = false) override;
 
+    /**
+     * Index subaddresses so get_address_index() resolves them in constant time.
+     *
+     * @param num_accounts is the number of accounts to index, starting from account 0
+     * @param num_subaddresses is the number of subaddresses to index per account
+     */
+    void build_subaddress_index(uint32_t num_accounts, uint32_t num_subaddresses);
+
+    /**
+     * Save the subaddress index to a file.
+     *
+     * @param path is the path of the file to write
+     */
+    void save_subaddress_index(const std::string& path) const;
+
+    /**
+     * Load a subaddress index saved for this wallet, memory mapping the file.
+     *
+     * @param path is the path of the file to read
+     * @return true if the index was loaded, false if the file does not exist or belongs to another wallet
+     */
+    bool load_subaddress_index(const std::string& path);
+
     // --------------------------------- PRIVATE --------------------------------
 
   private:
+    friend class monero_output_scanner;
+    static const uint32_t ADDRESS_CHUNK_SIZE = 256;  // minimum number of subaddresses derived per thread pool task
+
     bool m_is_view_only;
     monero_network_type m_network_type;
     cryptonote::account_base m_account;
@@ -147,6 +176,7 @@ namespace monero {
     std::string m_pub_spend_key;
     std::string m_prv_spend_key;
     std::string m_primary_address;
+    monero_subaddress_index m_subaddress_index;
 
     void init_common();
   };
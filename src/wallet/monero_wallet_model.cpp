@@ -55,6 +55,8 @@
 #include "utils/gen_utils.h"
 #include "utils/monero_utils.h"
 #include <iostream>
+#include <algorithm>
+#include <limits>
 
 /**
  * Public library interface.
@@ -73,6 +75,18 @@ namespace monero {
     transfers.push_back(transfer);
   }
 
+  bool opt_bool_equals(bool val, const boost::optional<bool>& opt_val) {
+    return opt_val != boost::none && val == *opt_val;
+  }
+
+  template <class T>
+  bool intersects(const std::unordered_set<T>& set, const std::vector<T>& values) {
+    for (const T& value : values) {
+      if (set.count(value) == 1) return true;
+    }
+    return false;
+  }
+
   std::shared_ptr<monero_block> node_to_block_query(const boost::property_tree::ptree& node) {
     std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
     for (boost::property_tree::ptree::const_iterator it = node.begin(); it != node.end(); ++it) {
@@ -293,23 +307,28 @@ namespace monero {
   }
 
   std::vector<std::shared_ptr<monero_transfer>> monero_tx_wallet::get_transfers(const monero_transfer_query& query) const {
+    monero_transfer_query_plan plan(query);
     std::vector<std::shared_ptr<monero_transfer>> transfers;
-    if (m_outgoing_transfer != boost::none && query.meets_criteria(m_outgoing_transfer.get().get())) transfers.push_back(m_outgoing_transfer.get());
-    for (const std::shared_ptr<monero_transfer>& transfer : m_incoming_transfers) if (query.meets_criteria(transfer.get())) transfers.push_back(transfer);
+    if (m_outgoing_transfer != boost::none && plan.meets_criteria(m_outgoing_transfer.get().get())) transfers.push_back(m_outgoing_transfer.get());
+    for (const std::shared_ptr<monero_transfer>& transfer : m_incoming_transfers) if (plan.meets_criteria(transfer.get())) transfers.push_back(transfer);
     return transfers;
   }
 
   std::vector<std::shared_ptr<monero_transfer>> monero_tx_wallet::filter_transfers(const monero_transfer_query& query) {
+    return filter_transfers(monero_transfer_query_plan(query));
+  }
+
+  std::vector<std::shared_ptr<monero_transfer>> monero_tx_wallet::filter_transfers(const monero_transfer_query_plan& plan) {
 
     // collect outgoing transfer, erase if excluded
     std::vector<std::shared_ptr<monero_transfer>> transfers;
-    if (m_outgoing_transfer != boost::none && query.meets_criteria(m_outgoing_transfer.get().get())) transfers.push_back(m_outgoing_transfer.get());
+    if (m_outgoing_transfer != boost::none && plan.meets_criteria(m_outgoing_transfer.get().get())) transfers.push_back(m_outgoing_transfer.get());
     else m_outgoing_transfer = boost::none;
 
     // collect incoming transfers, erase if excluded
     std::vector<std::shared_ptr<monero_incoming_transfer>>::iterator iter = m_incoming_transfers.begin();
     while (iter != m_incoming_transfers.end()) {
-      if (query.meets_criteria((*iter).get())) {
+      if (plan.meets_criteria((*iter).get())) {
         transfers.push_back(*iter);
         iter++;
       } else {
@@ -325,20 +344,25 @@ namespace monero {
   }
 
   std::vector<std::shared_ptr<monero_output_wallet>> monero_tx_wallet::get_outputs_wallet(const monero_output_query& query) const {
+    monero_output_query_plan plan(query);
     std::vector<std::shared_ptr<monero_output_wallet>> outputs;
     for (const std::shared_ptr<monero_output>& output : m_outputs) {
       std::shared_ptr<monero_output_wallet> output_wallet = std::dynamic_pointer_cast<monero_output_wallet>(output);
-      if (query.meets_criteria(output_wallet.get())) outputs.push_back(output_wallet);
+      if (plan.meets_criteria(output_wallet.get())) outputs.push_back(output_wallet);
     }
     return outputs;
   }
 
   std::vector<std::shared_ptr<monero_output_wallet>> monero_tx_wallet::filter_outputs_wallet(const monero_output_query& query) {
+    return filter_outputs_wallet(monero_output_query_plan(query));
+  }
+
+  std::vector<std::shared_ptr<monero_output_wallet>> monero_tx_wallet::filter_outputs_wallet(const monero_output_query_plan& plan) {
     std::vector<std::shared_ptr<monero_output_wallet>> outputs;
     std::vector<std::shared_ptr<monero_output>>::iterator iter = m_outputs.begin();
     while (iter != m_outputs.end()) {
       std::shared_ptr<monero_output_wallet> output_wallet = std::dynamic_pointer_cast<monero_output_wallet>(*iter);
-      if (query.meets_criteria(output_wallet.get())) {
+      if (plan.meets_criteria(output_wallet.get())) {
         outputs.push_back(output_wallet);
         iter++;
       } else {
@@ -460,72 +484,7 @@ namespace monero {
   };
 
   bool monero_tx_query::meets_criteria(monero_tx_wallet* tx, bool query_children) const {
-    if (tx == nullptr) throw std::runtime_error("nullptr given to monero_tx_query::meets_criteria()");
-
-    // filter on tx
-    if (m_hash != boost::none && m_hash != tx->m_hash) return false;
-    if (m_payment_id != boost::none && m_payment_id != tx->m_payment_id) return false;
-    if (m_is_confirmed != boost::none && m_is_confirmed != tx->m_is_confirmed) return false;
-    if (m_in_tx_pool != boost::none && m_in_tx_pool != tx->m_in_tx_pool) return false;
-    if (m_relay != boost::none && m_relay != tx->m_relay) return false;
-    if (m_is_failed != boost::none && m_is_failed != tx->m_is_failed) return false;
-    if (m_is_miner_tx != boost::none && m_is_miner_tx != tx->m_is_miner_tx) return false;
-    if (m_is_locked != boost::none && m_is_locked != tx->m_is_locked) return false;
-
-    // filter on having a payment id
-    if (m_has_payment_id != boost::none) {
-      if (*m_has_payment_id && tx->m_payment_id == boost::none) return false;
-      if (!*m_has_payment_id && tx->m_payment_id != boost::none) return false;
-    }
-
-    // filter on incoming
-    if (m_is_incoming != boost::none && m_is_incoming != tx->m_is_incoming) return false;
-
-    // filter on outgoing
-    if (m_is_outgoing != boost::none && m_is_outgoing != tx->m_is_outgoing) return false;
-
-    // filter on remaining fields
-    boost::optional<uint64_t> txHeight = tx->get_height();
-    if (!m_hashes.empty() && find(m_hashes.begin(), m_hashes.end(), *tx->m_hash) == m_hashes.end()) return false;
-    if (!m_payment_ids.empty() && (tx->m_payment_id == boost::none || find(m_payment_ids.begin(), m_payment_ids.end(), *tx->m_payment_id) == m_payment_ids.end())) return false;
-    if (m_height != boost::none && (txHeight == boost::none || *txHeight != *m_height)) return false;
-    if (m_min_height != boost::none && (txHeight == boost::none || *txHeight < *m_min_height)) return false;
-    if (m_max_height != boost::none && (txHeight == boost::none || *txHeight > *m_max_height)) return false;
-
-    // done if not querying transfers or outputs
-    if (!query_children) return true;
-
-    // at least one transfer must meet transfer query if defined
-    if (m_transfer_query != boost::none) {
-      bool match_found = false;
-      if (tx->m_outgoing_transfer != boost::none && m_transfer_query.get()->meets_criteria(tx->m_outgoing_transfer.get().get())) match_found = true;
-      else if (!tx->m_incoming_transfers.empty()) {
-        for (const std::shared_ptr<monero_incoming_transfer>& incoming_transfer : tx->m_incoming_transfers) {
-          if (m_transfer_query.get()->meets_criteria(incoming_transfer.get(), false)) {
-            match_found = true;
-            break;
-          }
-        }
-      }
-      if (!match_found) return false;
-    }
-
-    // at least one output must meet output query if defined
-    if (m_output_query != boost::none) {
-      if (tx->m_outputs.empty()) return false;
-      bool match_found = false;
-      for (const std::shared_ptr<monero_output>& output : tx->m_outputs) {
-        std::shared_ptr<monero_output_wallet> vout_wallet = std::static_pointer_cast<monero_output_wallet>(output);
-        if (m_output_query.get()->meets_criteria(vout_wallet.get(), false)) {
-          match_found = true;
-          break;
-        }
-      }
-      if (!match_found) return false;
-    }
-
-    // transaction meets query criteria
-    return true;
+    return monero_tx_query_plan(*this, query_children).meets_criteria(tx, query_children);
   }
 
   // -------------------------- MONERO DESTINATION ----------------------------
@@ -849,74 +808,7 @@ namespace monero {
   };
 
   bool monero_transfer_query::meets_criteria(monero_transfer* transfer, bool query_parent) const {
-    if (transfer == nullptr) throw std::runtime_error("nullptr given to monero_transfer_query::meets_criteria()");
-
-    // filter on common fields
-    if (is_incoming() != boost::none && *is_incoming() != *transfer->is_incoming()) return false;
-    if (is_outgoing() != boost::none && *is_outgoing() != *transfer->is_outgoing()) return false;
-    if (m_amount != boost::none && *m_amount != *transfer->m_amount) return false;
-    if (m_account_index != boost::none && *m_account_index != *transfer->m_account_index) return false;
-
-    // filter on incoming fields
-    monero_incoming_transfer* inTransfer = dynamic_cast<monero_incoming_transfer*>(transfer);
-    if (inTransfer != nullptr) {
-      if (m_has_destinations != boost::none) return false;
-      if (m_address != boost::none && *m_address != *inTransfer->m_address) return false;
-      if (!m_addresses.empty() && find(m_addresses.begin(), m_addresses.end(), *inTransfer->m_address) == m_addresses.end()) return false;
-      if (m_subaddress_index != boost::none && *m_subaddress_index != *inTransfer->m_subaddress_index) return false;
-      if (!m_subaddress_indices.empty() && find(m_subaddress_indices.begin(), m_subaddress_indices.end(), *inTransfer->m_subaddress_index) == m_subaddress_indices.end()) return false;
-    }
-
-    // filter on outgoing fields
-    monero_outgoing_transfer* out_transfer = dynamic_cast<monero_outgoing_transfer*>(transfer);
-    if (out_transfer != nullptr) {
-
-      // filter on addresses
-      if (m_address != boost::none && (out_transfer->m_addresses.empty() || find(out_transfer->m_addresses.begin(), out_transfer->m_addresses.end(), *m_address) == out_transfer->m_addresses.end())) return false;   // TODO: will filter all transfers if they don't contain addresses
-      if (!m_addresses.empty()) {
-        bool intersects = false;
-        for (const std::string& addressReq : m_addresses) {
-          for (const std::string& address : out_transfer->m_addresses) {
-            if (addressReq == address) {
-              intersects = true;
-              break;
-            }
-          }
-        }
-        if (!intersects) return false;  // must have overlapping addresses
-      }
-
-      // filter on subaddress indices
-      if (m_subaddress_index != boost::none && (out_transfer->m_subaddress_indices.empty() || find(out_transfer->m_subaddress_indices.begin(), out_transfer->m_subaddress_indices.end(), *m_subaddress_index) == out_transfer->m_subaddress_indices.end())) return false;   // TODO: will filter all transfers if they don't contain subaddress indices
-      if (!m_subaddress_indices.empty()) {
-        bool intersects = false;
-        for (const uint32_t& subaddressIndexReq : m_subaddress_indices) {
-          for (const uint32_t& m_subaddress_index : out_transfer->m_subaddress_indices) {
-            if (subaddressIndexReq == m_subaddress_index) {
-              intersects = true;
-              break;
-            }
-          }
-        }
-        if (!intersects) return false;  // must have overlapping subaddress indices
-      }
-
-      // filter on having destinations
-      if (m_has_destinations != boost::none) {
-        if (*m_has_destinations && out_transfer->m_destinations.empty()) return false;
-        if (!*m_has_destinations && !out_transfer->m_destinations.empty()) return false;
-      }
-
-      // filter on destinations TODO: start with test for this
-      //    if (this.getDestionations() != null && this.getDestionations() != transfer.getDestionations()) return false;
-    }
-
-    // validate type
-    if (inTransfer == nullptr && out_transfer == nullptr) throw std::runtime_error("Transfer must be monero_incoming_transfer or monero_outgoing_transfer");
-
-    // filter with tx query
-    if (query_parent && m_tx_query != boost::none && !(*m_tx_query)->meets_criteria(transfer->m_tx.get(), false)) return false;
-    return true;
+    return monero_transfer_query_plan(*this, query_parent).meets_criteria(transfer, query_parent);
   }
 
   boost::optional<bool> monero_transfer_query::is_incoming() const { return m_is_incoming; }
@@ -1073,28 +965,230 @@ namespace monero {
   };
 
   bool monero_output_query::meets_criteria(monero_output_wallet* output, bool query_parent) const {
-    if (output == nullptr) throw std::runtime_error("nullptr given to monero_output_query::meets_criteria()");
+    return monero_output_query_plan(*this, query_parent).meets_criteria(output, query_parent);
+  }
 
-    // filter on output
-    if (m_account_index != boost::none && (output->m_account_index == boost::none || *m_account_index != *output->m_account_index)) return false;
-    if (m_subaddress_index != boost::none && (output->m_subaddress_index == boost::none || *m_subaddress_index != *output->m_subaddress_index)) return false;
-    if (m_amount != boost::none && (output->m_amount == boost::none || *m_amount != *output->m_amount)) return false;
-    if (m_is_spent != boost::none && (output->m_is_spent == boost::none || *m_is_spent != *output->m_is_spent)) return false;
-
-    // filter on output key image
-    if (m_key_image != boost::none) {
-      if (output->m_key_image == boost::none) return false;
-      if ((*m_key_image)->m_hex != boost::none && ((*output->m_key_image)->m_hex == boost::none || *(*m_key_image)->m_hex != *(*output->m_key_image)->m_hex)) return false;
-      if ((*m_key_image)->m_signature != boost::none && ((*output->m_key_image)->m_signature == boost::none || *(*m_key_image)->m_signature != *(*output->m_key_image)->m_signature)) return false;
+  // ------------------------- MONERO TX QUERY PLAN ---------------------------
+
+  monero_tx_query_plan::monero_tx_query_plan(const monero_tx_query& query, bool compile_children) : m_has_payment_id(false), m_min_height(0), m_max_height(std::numeric_limits<uint64_t>::max()), m_is_confirmed(false), m_in_tx_pool(false), m_relay(false), m_is_failed(false), m_is_miner_tx(false), m_is_locked(false), m_is_incoming(false), m_is_outgoing(false) {
+
+    // compile most selective criteria first
+    if (query.m_hash != boost::none) {
+      m_hash = query.m_hash;
+      m_ops.push_back(HASH);
+    }
+    if (!query.m_hashes.empty()) {
+      for (const std::string& hash_hex : query.m_hashes) {
+        crypto::hash hash;
+        if (monero_lazy_hex(hash_hex).get_pod(hash)) m_hashes.insert(hash);
+        else m_hash_strs.insert(hash_hex);
+      }
+      m_ops.push_back(HASHES);
+    }
+    if (query.m_payment_id != boost::none) {
+      m_payment_id = *query.m_payment_id;
+      m_ops.push_back(PAYMENT_ID);
+    }
+    if (!query.m_payment_ids.empty()) {
+      m_payment_ids.insert(query.m_payment_ids.begin(), query.m_payment_ids.end());
+      m_ops.push_back(PAYMENT_IDS);
+    }
+    if (query.m_has_payment_id != boost::none) {
+      m_has_payment_id = *query.m_has_payment_id;
+      m_ops.push_back(HAS_PAYMENT_ID);
     }
 
-    // filter on extensions
-    if (!m_subaddress_indices.empty() && find(m_subaddress_indices.begin(), m_subaddress_indices.end(), *output->m_subaddress_index) == m_subaddress_indices.end()) return false;
-    if (m_min_amount != boost::none && (output->m_amount == boost::none || output->m_amount.get() < m_min_amount.get())) return false;
-    if (m_max_amount != boost::none && (output->m_amount == boost::none || output->m_amount.get() > m_max_amount.get())) return false;
+    // resolve height criteria to one inclusive range
+    if (query.m_height != boost::none || query.m_min_height != boost::none || query.m_max_height != boost::none) {
+      if (query.m_height != boost::none) m_min_height = m_max_height = *query.m_height;
+      if (query.m_min_height != boost::none) m_min_height = std::max(m_min_height, *query.m_min_height);
+      if (query.m_max_height != boost::none) m_max_height = std::min(m_max_height, *query.m_max_height);
+      m_ops.push_back(HEIGHT);
+    }
+
+    // compile state criteria
+    if (query.m_is_confirmed != boost::none) { m_is_confirmed = *query.m_is_confirmed; m_ops.push_back(IS_CONFIRMED); }
+    if (query.m_in_tx_pool != boost::none) { m_in_tx_pool = *query.m_in_tx_pool; m_ops.push_back(IN_TX_POOL); }
+    if (query.m_relay != boost::none) { m_relay = *query.m_relay; m_ops.push_back(RELAY); }
+    if (query.m_is_failed != boost::none) { m_is_failed = *query.m_is_failed; m_ops.push_back(IS_FAILED); }
+    if (query.m_is_miner_tx != boost::none) { m_is_miner_tx = *query.m_is_miner_tx; m_ops.push_back(IS_MINER_TX); }
+    if (query.m_is_locked != boost::none) { m_is_locked = *query.m_is_locked; m_ops.push_back(IS_LOCKED); }
+    if (query.m_is_incoming != boost::none) { m_is_incoming = *query.m_is_incoming; m_ops.push_back(IS_INCOMING); }
+    if (query.m_is_outgoing != boost::none) { m_is_outgoing = *query.m_is_outgoing; m_ops.push_back(IS_OUTGOING); }
+
+    // compile transfer and output queries
+    if (!compile_children) return;
+    if (query.m_transfer_query != boost::none) m_transfer_plan = std::make_shared<monero_transfer_query_plan>(*query.m_transfer_query.get());
+    if (query.m_output_query != boost::none) m_output_plan = std::make_shared<monero_output_query_plan>(*query.m_output_query.get());
+  }
+
+  bool monero_tx_query_plan::meets_criteria(monero_tx_wallet* tx, bool query_children) const {
+    if (tx == nullptr) throw std::runtime_error("nullptr given to monero_tx_query_plan::meets_criteria()");
+
+    // filter on tx
+    for (op o : m_ops) {
+      switch (o) {
+        case HASH: if (tx->m_hash != m_hash) return false; break;
+        case HASHES: {
+          if (tx->m_hash == boost::none) return false;
+          crypto::hash hash;
+          if (tx->m_hash.get_pod(hash) ? m_hashes.count(hash) == 0 : m_hash_strs.count(*tx->m_hash) == 0) return false;
+          break;
+        }
+        case PAYMENT_ID: if (tx->m_payment_id == boost::none || *tx->m_payment_id != m_payment_id) return false; break;
+        case PAYMENT_IDS: if (tx->m_payment_id == boost::none || m_payment_ids.count(*tx->m_payment_id) == 0) return false; break;
+        case HAS_PAYMENT_ID: if (m_has_payment_id != (tx->m_payment_id != boost::none)) return false; break;
+        case HEIGHT: {
+          boost::optional<uint64_t> height = tx->get_height();
+          if (height == boost::none || *height < m_min_height || *height > m_max_height) return false;
+          break;
+        }
+        case IS_CONFIRMED: if (!opt_bool_equals(m_is_confirmed, tx->m_is_confirmed)) return false; break;
+        case IN_TX_POOL: if (!opt_bool_equals(m_in_tx_pool, tx->m_in_tx_pool)) return false; break;
+        case RELAY: if (!opt_bool_equals(m_relay, tx->m_relay)) return false; break;
+        case IS_FAILED: if (!opt_bool_equals(m_is_failed, tx->m_is_failed)) return false; break;
+        case IS_MINER_TX: if (!opt_bool_equals(m_is_miner_tx, tx->m_is_miner_tx)) return false; break;
+        case IS_LOCKED: if (!opt_bool_equals(m_is_locked, tx->m_is_locked)) return false; break;
+        case IS_INCOMING: if (!opt_bool_equals(m_is_incoming, tx->m_is_incoming)) return false; break;
+        case IS_OUTGOING: if (!opt_bool_equals(m_is_outgoing, tx->m_is_outgoing)) return false; break;
+      }
+    }
+
+    // done if not querying transfers or outputs
+    if (!query_children) return true;
+
+    // at least one transfer must meet transfer query if defined
+    if (m_transfer_plan != nullptr) {
+      bool match_found = tx->m_outgoing_transfer != boost::none && m_transfer_plan->meets_criteria(tx->m_outgoing_transfer.get().get());
+      for (size_t i = 0; !match_found && i < tx->m_incoming_transfers.size(); i++) {
+        match_found = m_transfer_plan->meets_criteria(tx->m_incoming_transfers[i].get(), false);
+      }
+      if (!match_found) return false;
+    }
+
+    // at least one output must meet output query if defined
+    if (m_output_plan != nullptr) {
+      bool match_found = false;
+      for (size_t i = 0; !match_found && i < tx->m_outputs.size(); i++) {
+        match_found = m_output_plan->meets_criteria(std::static_pointer_cast<monero_output_wallet>(tx->m_outputs[i]).get(), false);
+      }
+      if (!match_found) return false;
+    }
+
+    // transaction meets query criteria
+    return true;
+  }
+
+  // ---------------------- MONERO TRANSFER QUERY PLAN ------------------------
+
+  monero_transfer_query_plan::monero_transfer_query_plan(const monero_transfer_query& query, bool compile_parent) : m_is_incoming(false), m_amount(0), m_account_index(0), m_subaddress_index(0), m_has_destinations(false) {
+    if (query.is_incoming() != boost::none) { m_is_incoming = *query.is_incoming(); m_ops.push_back(IS_INCOMING); }
+    if (query.m_account_index != boost::none) { m_account_index = *query.m_account_index; m_ops.push_back(ACCOUNT_INDEX); }
+    if (query.m_subaddress_index != boost::none) { m_subaddress_index = *query.m_subaddress_index; m_ops.push_back(SUBADDRESS_INDEX); }
+    if (!query.m_subaddress_indices.empty()) {
+      m_subaddress_indices.insert(query.m_subaddress_indices.begin(), query.m_subaddress_indices.end());
+      m_ops.push_back(SUBADDRESS_INDICES);
+    }
+    if (query.m_amount != boost::none) { m_amount = *query.m_amount; m_ops.push_back(AMOUNT); }
+    if (query.m_address != boost::none) { m_address = *query.m_address; m_ops.push_back(ADDRESS); }
+    if (!query.m_addresses.empty()) {
+      m_addresses.insert(query.m_addresses.begin(), query.m_addresses.end());
+      m_ops.push_back(ADDRESSES);
+    }
+    if (query.m_has_destinations != boost::none) { m_has_destinations = *query.m_has_destinations; m_ops.push_back(HAS_DESTINATIONS); }
+    if (compile_parent && query.m_tx_query != boost::none) m_tx_plan = std::make_shared<monero_tx_query_plan>(*query.m_tx_query.get(), false);
+  }
+
+  bool monero_transfer_query_plan::meets_criteria(monero_transfer* transfer, bool query_parent) const {
+    if (transfer == nullptr) throw std::runtime_error("nullptr given to monero_transfer_query_plan::meets_criteria()");
+
+    // resolve transfer type
+    monero_incoming_transfer* in_transfer = dynamic_cast<monero_incoming_transfer*>(transfer);
+    monero_outgoing_transfer* out_transfer = in_transfer == nullptr ? dynamic_cast<monero_outgoing_transfer*>(transfer) : nullptr;
+    if (in_transfer == nullptr && out_transfer == nullptr) throw std::runtime_error("Transfer must be monero_incoming_transfer or monero_outgoing_transfer");
+
+    // filter on transfer
+    for (op o : m_ops) {
+      switch (o) {
+        case IS_INCOMING: if (m_is_incoming != (in_transfer != nullptr)) return false; break;
+        case AMOUNT: if (transfer->m_amount == boost::none || *transfer->m_amount != m_amount) return false; break;
+        case ACCOUNT_INDEX: if (transfer->m_account_index == boost::none || *transfer->m_account_index != m_account_index) return false; break;
+        case ADDRESS:
+          if (in_transfer != nullptr) { if (in_transfer->m_address == boost::none || *in_transfer->m_address != m_address) return false; }
+          else if (std::find(out_transfer->m_addresses.begin(), out_transfer->m_addresses.end(), m_address) == out_transfer->m_addresses.end()) return false; // TODO: will filter all transfers if they don't contain addresses
+          break;
+        case ADDRESSES:
+          if (in_transfer != nullptr) { if (in_transfer->m_address == boost::none || m_addresses.count(*in_transfer->m_address) == 0) return false; }
+          else if (!intersects(m_addresses, out_transfer->m_addresses)) return false; // must have overlapping addresses
+          break;
+        case SUBADDRESS_INDEX:
+          if (in_transfer != nullptr) { if (in_transfer->m_subaddress_index == boost::none || *in_transfer->m_subaddress_index != m_subaddress_index) return false; }
+          else if (std::find(out_transfer->m_subaddress_indices.begin(), out_transfer->m_subaddress_indices.end(), m_subaddress_index) == out_transfer->m_subaddress_indices.end()) return false; // TODO: will filter all transfers if they don't contain subaddress indices
+          break;
+        case SUBADDRESS_INDICES:
+          if (in_transfer != nullptr) { if (in_transfer->m_subaddress_index == boost::none || m_subaddress_indices.count(*in_transfer->m_subaddress_index) == 0) return false; }
+          else if (!intersects(m_subaddress_indices, out_transfer->m_subaddress_indices)) return false; // must have overlapping subaddress indices
+          break;
+        case HAS_DESTINATIONS:
+          if (in_transfer != nullptr) return false; // incoming transfers do not have destinations
+          if (m_has_destinations == out_transfer->m_destinations.empty()) return false;
+          break;
+      }
+    }
+
+    // filter with tx query
+    if (query_parent && m_tx_plan != nullptr && !m_tx_plan->meets_criteria(transfer->m_tx.get(), false)) return false;
+    return true;
+  }
+
+  // ----------------------- MONERO OUTPUT QUERY PLAN -------------------------
+
+  monero_output_query_plan::monero_output_query_plan(const monero_output_query& query, bool compile_parent) : m_account_index(0), m_subaddress_index(0), m_amount(0), m_min_amount(0), m_max_amount(0), m_is_spent(false), m_is_frozen(false) {
+    if (query.m_account_index != boost::none) { m_account_index = *query.m_account_index; m_ops.push_back(ACCOUNT_INDEX); }
+    if (query.m_subaddress_index != boost::none) { m_subaddress_index = *query.m_subaddress_index; m_ops.push_back(SUBADDRESS_INDEX); }
+    if (!query.m_subaddress_indices.empty()) {
+      m_subaddress_indices.insert(query.m_subaddress_indices.begin(), query.m_subaddress_indices.end());
+      m_ops.push_back(SUBADDRESS_INDICES);
+    }
+    if (query.m_amount != boost::none) { m_amount = *query.m_amount; m_ops.push_back(AMOUNT); }
+    if (query.m_min_amount != boost::none) { m_min_amount = *query.m_min_amount; m_ops.push_back(MIN_AMOUNT); }
+    if (query.m_max_amount != boost::none) { m_max_amount = *query.m_max_amount; m_ops.push_back(MAX_AMOUNT); }
+    if (query.m_is_spent != boost::none) { m_is_spent = *query.m_is_spent; m_ops.push_back(IS_SPENT); }
+    if (query.m_is_frozen != boost::none) { m_is_frozen = *query.m_is_frozen; m_ops.push_back(IS_FROZEN); }
+    if (query.m_key_image != boost::none) {
+      m_key_image_hex = (*query.m_key_image)->m_hex;
+      m_key_image_signature = (*query.m_key_image)->m_signature;
+      m_ops.push_back(KEY_IMAGE);
+    }
+    if (compile_parent && query.m_tx_query != boost::none) m_tx_plan = std::make_shared<monero_tx_query_plan>(*query.m_tx_query.get(), false);
+  }
+
+  bool monero_output_query_plan::meets_criteria(monero_output_wallet* output, bool query_parent) const {
+    if (output == nullptr) throw std::runtime_error("nullptr given to monero_output_query_plan::meets_criteria()");
+
+    // filter on output
+    for (op o : m_ops) {
+      switch (o) {
+        case ACCOUNT_INDEX: if (output->m_account_index == boost::none || *output->m_account_index != m_account_index) return false; break;
+        case SUBADDRESS_INDEX: if (output->m_subaddress_index == boost::none || *output->m_subaddress_index != m_subaddress_index) return false; break;
+        case SUBADDRESS_INDICES: if (output->m_subaddress_index == boost::none || m_subaddress_indices.count(*output->m_subaddress_index) == 0) return false; break;
+        case AMOUNT: if (output->m_amount == boost::none || *output->m_amount != m_amount) return false; break;
+        case MIN_AMOUNT: if (output->m_amount == boost::none || *output->m_amount < m_min_amount) return false; break;
+        case MAX_AMOUNT: if (output->m_amount == boost::none || *output->m_amount > m_max_amount) return false; break;
+        case IS_SPENT: if (!opt_bool_equals(m_is_spent, output->m_is_spent)) return false; break;
+        case IS_FROZEN: if (!opt_bool_equals(m_is_frozen, output->m_is_frozen)) return false; break;
+        case KEY_IMAGE: {
+          if (output->m_key_image == boost::none) return false;
+          const std::shared_ptr<monero_key_image>& key_image = *output->m_key_image;
+          if (m_key_image_hex != boost::none && key_image->m_hex != m_key_image_hex) return false;
+          if (m_key_image_signature != boost::none && (key_image->m_signature == boost::none || *key_image->m_signature != *m_key_image_signature)) return false;
+          break;
+        }
+      }
+    }
 
     // filter with tx query
-    if (query_parent && m_tx_query != boost::none && !(*m_tx_query)->meets_criteria(std::static_pointer_cast<monero_tx_wallet>(output->m_tx).get(), false)) return false;
+    if (query_parent && m_tx_plan != nullptr && !m_tx_plan->meets_criteria(std::static_pointer_cast<monero_tx_wallet>(output->m_tx).get(), false)) return false;
 
     // output meets query
     return true;
@@ -53,6 +53,8 @@
 #pragma once
 
 #include "daemon/monero_daemon_model.h"
+#include "crypto/hash.h"
+#include <unordered_set>
 
 using namespace monero;
 
@@ -121,6 +123,9 @@ namespace monero {
   struct monero_tx_wallet;
   struct monero_tx_query;
   struct monero_tx_set;
+  class monero_tx_query_plan;
+  class monero_transfer_query_plan;
+  class monero_output_query_plan;
 
   /**
    * Models a base transfer of funds to or from the wallet.
@@ -243,18 +248,18 @@ namespace monero {
    */
   struct monero_tx_wallet : public monero_tx {
     boost::optional<std::shared_ptr<monero_tx_set>> m_tx_set;
-    boost::optional<bool> m_is_incoming;
-    boost::optional<bool> m_is_outgoing;
-    std::vector<std::shared_ptr<monero_incoming_transfer>> m_incoming_transfers;
     boost::optional<std::shared_ptr<monero_outgoing_transfer>> m_outgoing_transfer;
-    boost::optional<std::string> m_note;
-    boost::optional<bool> m_is_locked;
+    std::vector<std::shared_ptr<monero_incoming_transfer>> m_incoming_transfers;
     boost::optional<uint64_t> m_input_sum;
     boost::optional<uint64_t> m_output_sum;
-    boost::optional<std::string> m_change_address;
     boost::optional<uint64_t> m_change_amount;
     boost::optional<uint32_t> m_num_dummy_outputs;
-    boost::optional<std::string> m_extra_hex;
+    boost::optional<bool> m_is_incoming;
+    boost::optional<bool> m_is_outgoing;
+    boost::optional<bool> m_is_locked;
+    gen_utils::boxed_optional<std::string> m_note;
+    gen_utils::boxed_optional<std::string> m_change_address;
+    gen_utils::boxed_optional<std::string> m_extra_hex;
 
     rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
     static void from_property_tree(const boost::property_tree::ptree& node, const std::shared_ptr<monero_tx_wallet>& tx_wallet);
@@ -265,9 +270,11 @@ namespace monero {
     std::vector<std::shared_ptr<monero_transfer>> get_transfers() const;
     std::vector<std::shared_ptr<monero_transfer>> get_transfers(const monero_transfer_query& query) const;
     std::vector<std::shared_ptr<monero_transfer>> filter_transfers(const monero_transfer_query& query);
+    std::vector<std::shared_ptr<monero_transfer>> filter_transfers(const monero_transfer_query_plan& plan);
     std::vector<std::shared_ptr<monero_output_wallet>> get_outputs_wallet() const;
     std::vector<std::shared_ptr<monero_output_wallet>> get_outputs_wallet(const monero_output_query& query) const;
     std::vector<std::shared_ptr<monero_output_wallet>> filter_outputs_wallet(const monero_output_query& query);
+    std::vector<std::shared_ptr<monero_output_wallet>> filter_outputs_wallet(const monero_output_query_plan& plan);
   };
 
   /**
@@ -297,6 +304,166 @@ namespace monero {
     bool meets_criteria(monero_tx_wallet* tx, bool query_children = true) const;
   };
 
+  // ------------------------------- QUERY PLANS --------------------------------
+
+  /**
+   * Compiled form of a monero_tx_query to evaluate against many txs.
+   *
+   * Only the query's defined criteria are checked, hashes are matched in binary, hashes and
+   * payment ids are looked up in hash sets, and height criteria are resolved to one range.
+   * The plan copies the query's criteria, so later changes to the query are not reflected.
+   * Queries evaluate single txs, transfers, and outputs by compiling a plan.
+   */
+  class monero_tx_query_plan {
+
+  public:
+
+    /**
+     * Compile a tx query.
+     *
+     * @param query is the query to compile
+     * @param compile_children specifies if the query's transfer and output queries are compiled
+     */
+    monero_tx_query_plan(const monero_tx_query& query, bool compile_children = true);
+
+    /**
+     * Indicates if a tx meets the compiled query.
+     *
+     * @param tx is the tx to evaluate
+     * @param query_children specifies if the tx's transfers and outputs are evaluated (only if compiled)
+     * @return true if the tx meets the query, false otherwise
+     */
+    bool meets_criteria(monero_tx_wallet* tx, bool query_children = true) const;
+
+  private:
+    enum op : uint8_t { HASH, HASHES, PAYMENT_ID, PAYMENT_IDS, HAS_PAYMENT_ID, HEIGHT, IS_CONFIRMED, IN_TX_POOL, RELAY, IS_FAILED, IS_MINER_TX, IS_LOCKED, IS_INCOMING, IS_OUTGOING };
+    std::vector<op> m_ops;                       // checks of defined criteria in evaluation order
+    monero_lazy_hex m_hash;
+    std::unordered_set<crypto::hash> m_hashes;
+    std::unordered_set<std::string> m_hash_strs;  // hashes which are not hex of 32 bytes
+    std::string m_payment_id;
+    std::unordered_set<std::string> m_payment_ids;
+    bool m_has_payment_id;
+    uint64_t m_min_height;                       // inclusive
+    uint64_t m_max_height;                       // inclusive
+    bool m_is_confirmed;
+    bool m_in_tx_pool;
+    bool m_relay;
+    bool m_is_failed;
+    bool m_is_miner_tx;
+    bool m_is_locked;
+    bool m_is_incoming;
+    bool m_is_outgoing;
+    std::shared_ptr<monero_transfer_query_plan> m_transfer_plan;
+    std::shared_ptr<monero_output_query_plan> m_output_plan;
+  };
+
+  /**
+   * Compiled form of a monero_transfer_query to evaluate against many transfers.
+   */
+  class monero_transfer_query_plan {
+
+  public:
+
+    /**
+     * Compile a transfer query.
+     *
+     * @param query is the query to compile
+     * @param compile_parent specifies if the query's tx query is compiled
+     */
+    monero_transfer_query_plan(const monero_transfer_query& query, bool compile_parent = true);
+
+    /**
+     * Indicates if a transfer meets the compiled query.
+     *
+     * @param transfer is the transfer to evaluate
+     * @param query_parent specifies if the transfer's tx is evaluated (only if compiled)
+     * @return true if the transfer meets the query, false otherwise
+     */
+    bool meets_criteria(monero_transfer* transfer, bool query_parent = true) const;
+
+  private:
+    enum op : uint8_t { IS_INCOMING, AMOUNT, ACCOUNT_INDEX, ADDRESS, ADDRESSES, SUBADDRESS_INDEX, SUBADDRESS_INDICES, HAS_DESTINATIONS };
+    std::vector<op> m_ops;                       // checks of defined criteria in evaluation order
+    bool m_is_incoming;
+    uint64_t m_amount;
+    uint32_t m_account_index;
+    std::string m_address;
+    std::unordered_set<std::string> m_addresses;
+    uint32_t m_subaddress_index;
+    std::unordered_set<uint32_t> m_subaddress_indices;
+    bool m_has_destinations;
+    std::shared_ptr<monero_tx_query_plan> m_tx_plan;
+  };
+
+  /**
+   * Compiled form of a monero_output_query to evaluate against many outputs.
+   */
+  class monero_output_query_plan {
+
+  public:
+
+    /**
+     * Compile an output query.
+     *
+     * @param query is the query to compile
+     * @param compile_parent specifies if the query's tx query is compiled
+     */
+    monero_output_query_plan(const monero_output_query& query, bool compile_parent = true);
+
+    /**
+     * Indicates if an output meets the compiled query.
+     *
+     * @param output is the output to evaluate
+     * @param query_parent specifies if the output's tx is evaluated (only if compiled)
+     * @return true if the output meets the query, false otherwise
+     */
+    bool meets_criteria(monero_output_wallet* output, bool query_parent = true) const;
+
+  private:
+    enum op : uint8_t { ACCOUNT_INDEX, SUBADDRESS_INDEX, SUBADDRESS_INDICES, AMOUNT, MIN_AMOUNT, MAX_AMOUNT, IS_SPENT, IS_FROZEN, KEY_IMAGE };
+    std::vector<op> m_ops;                       // checks of defined criteria in evaluation order
+    uint32_t m_account_index;
+    uint32_t m_subaddress_index;
+    std::unordered_set<uint32_t> m_subaddress_indices;
+    uint64_t m_amount;
+    uint64_t m_min_amount;
+    uint64_t m_max_amount;
+    bool m_is_spent;
+    bool m_is_frozen;
+    monero_lazy_hex m_key_image_hex;
+    boost::optional<std::string> m_key_image_signature;
+    std::shared_ptr<monero_tx_query_plan> m_tx_plan;
+  };
+
+  // ------------------------------ PAGED QUERIES -------------------------------
+
+  /**
+   * Position in ascending height order to resume a paged query from.
+   */
+  struct monero_page_cursor {
+    uint64_t m_height;       // height of the next result
+    uint64_t m_offset;       // number of results at the height already returned
+    bool m_is_confirmed;     // false once paging has reached unconfirmed results
+    monero_page_cursor() : m_height(0), m_offset(0), m_is_confirmed(true) {}
+  };
+
+  /**
+   * One page of transfers and the position of the next page.
+   */
+  struct monero_transfer_page {
+    std::vector<std::shared_ptr<monero_transfer>> m_transfers;
+    boost::optional<monero_page_cursor> m_next_cursor;  // none if no transfers remain
+  };
+
+  /**
+   * One page of outputs and the position of the next page.
+   */
+  struct monero_output_page {
+    std::vector<std::shared_ptr<monero_output_wallet>> m_outputs;
+    boost::optional<monero_page_cursor> m_next_cursor;  // none if no outputs remain
+  };
+
   /**
    * Groups transactions who share common hex data which is needed in order to
    * sign and submit the transactions.
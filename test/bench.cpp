@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
+#include <unordered_map>
+#include "wallet2.h"
+#include "wallet/monero_wallet_core.h"
+#include "wallet/monero_wallet_keys.h"
+#include "utils/monero_utils.h"
+#include "rpc/core_rpc_server_commands_defs.h"
+#include "ringct/rctOps.h"
+#include "storages/portable_storage_template_helper.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "string_tools.h"
+
+using namespace std;
+using namespace monero;
+
+/**
+ * Benchmarks for wallet query, sync and serialization hot paths.
+ *
+ * Every benchmark runs over state which is generated from a fixed seed or
+ * loaded from wallet files through open_wallet_data(), so results can be
+ * compared between builds without a daemon.
+ *
+ * Usage: monero-cpp-bench [--iterations n] [--blocks n]
+ *                         [--keys path --cache path]
+ *                         [--password password] [--network 0|1|2]
+ *                         [--daemon uri]
+ *
+ * Without wallet files, queries run over a wallet whose history is a seeded
+ * synthetic chain of blocks paying and spending it, replayed through wallet2's
+ * block processing.  Replaying that chain is also benchmarked as the sync path
+ * without network.  create_txs() is only benchmarked if a daemon is given since
+ * it needs decoys and fee estimates.
+ */
+
+/**
+ * wallet2 befriends this class for monero's core tests.  The benchmarks use it to
+ * feed synthetic blocks through wallet2's block processing as a sync would.
+ */
+class wallet_accessor_test {
+public:
+  typedef tools::wallet2::parsed_block parsed_block;
+  static void process_parsed_blocks(tools::wallet2& w2, uint64_t start_height, const std::vector<cryptonote::block_complete_entry>& blocks, const std::vector<parsed_block>& parsed_blocks) {
+    uint64_t blocks_added = 0;
+    w2.process_parsed_blocks(start_height, blocks, parsed_blocks, blocks_added);
+  }
+};
+
+// -------------------------------- HARNESS -----------------------------------
+
+const uint64_t SEED = 20200101;
+const size_t DEFAULT_NUM_BLOCKS = 1000;
+const size_t TXS_PER_BLOCK = 4;
+const uint32_t NUM_SUBADDRESSES = 20;
+
+/**
+ * Run a benchmark and print its per-iteration timings in microseconds.
+ *
+ * @param name identifies the benchmark in the output
+ * @param iterations is the number of timed iterations after one warm up
+ * @param fn runs one iteration
+ */
+template <class F>
+void run_bench(const string& name, int iterations, F fn) {
+  fn(); // warm up caches and lazy initialization
+  vector<double> samples;
+  samples.reserve(iterations);
+  for (int i = 0; i < iterations; i++) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    fn();
+    samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+  }
+  sort(samples.begin(), samples.end());
+  double total = 0;
+  for (double sample : samples) total += sample;
+  cout << left << setw(40) << name << right
+       << setw(8) << iterations
+       << setw(14) << fixed << setprecision(1) << samples.front()
+       << setw(14) << samples[samples.size() / 2]
+       << setw(14) << total / samples.size() << endl;
+}
+
+template <class T>
+T random_pod(mt19937_64& rng) {
+  T pod;
+  unsigned char* bytes = reinterpret_cast<unsigned char*>(&pod);
+  for (size_t i = 0; i < sizeof(T); i++) bytes[i] = static_cast<unsigned char>(rng());
+  return pod;
+}
+
+crypto::secret_key random_scalar(mt19937_64& rng) {
+  crypto::secret_key scalar;
+  crypto::hash seed = random_pod<crypto::hash>(rng);
+  crypto::hash_to_scalar(&seed, sizeof(seed), scalar);
+  return scalar;
+}
+
+/**
+ * Free the tx graphs of query results, which hold tx <-> block, tx <-> transfer or
+ * output, and tx <-> tx set cycles.
+ */
+void free_txs(const vector<shared_ptr<monero_tx_wallet>>& txs) {
+  set<shared_ptr<monero_block>> blocks;
+  shared_ptr<monero_block> unconfirmed = make_shared<monero_block>(); // groups unconfirmed txs to free them alike
+  for (const shared_ptr<monero_tx_wallet>& tx : txs) {
+    tx->m_tx_set = boost::none; // created txs reference their tx set
+    if (tx->m_block != boost::none) blocks.insert(tx->m_block.get());
+    else unconfirmed->m_txs.push_back(tx);
+  }
+  for (const shared_ptr<monero_block>& block : blocks) monero_utils::free(block);
+  monero_utils::free(unconfirmed);
+}
+
+template <class T>
+void free_results(const vector<shared_ptr<T>>& results) {
+  vector<shared_ptr<monero_tx_wallet>> txs;
+  for (const shared_ptr<T>& result : results) txs.push_back(static_pointer_cast<monero_tx_wallet>(result->m_tx));
+  free_txs(txs);
+}
+
+string read_file(const string& path) {
+  ifstream file(path, ios::binary);
+  if (!file) throw runtime_error("Cannot read " + path);
+  stringstream buf;
+  buf << file.rdbuf();
+  return buf.str();
+}
+
+// --------------------------- SYNTHETIC STATE --------------------------------
+
+/**
+ * Build a block of wallet txs with transfers and outputs shaped like a busy
+ * wallet's history.
+ */
+shared_ptr<monero_block> build_tx_graph(mt19937_64& rng, size_t num_txs) {
+  shared_ptr<monero_block> block = make_shared<monero_block>();
+  block->m_height = 100000;
+  block->m_timestamp = 1577836800;
+  for (size_t i = 0; i < num_txs; i++) {
+    shared_ptr<monero_tx_wallet> tx = make_shared<monero_tx_wallet>();
+    tx->m_block = block;
+    block->m_txs.push_back(tx);
+    tx->m_hash = epee::string_tools::pod_to_hex(random_pod<crypto::hash>(rng));
+    tx->m_fee = rng() % 100000000;
+    tx->m_is_confirmed = true;
+    tx->m_in_tx_pool = false;
+    tx->m_is_relayed = true;
+    tx->m_is_failed = false;
+    tx->m_is_miner_tx = false;
+    tx->m_unlock_time = 0;
+    tx->m_num_confirmations = rng() % 1000;
+    tx->m_is_locked = false;
+    tx->m_is_incoming = true;
+    tx->m_is_outgoing = i % 2 == 0;
+    for (int j = 0; j < 2; j++) {
+      shared_ptr<monero_incoming_transfer> transfer = make_shared<monero_incoming_transfer>();
+      transfer->m_tx = tx;
+      transfer->m_amount = rng() % 1000000000000;
+      transfer->m_account_index = 0;
+      transfer->m_subaddress_index = j;
+      tx->m_incoming_transfers.push_back(transfer);
+
+      shared_ptr<monero_output_wallet> output = make_shared<monero_output_wallet>();
+      output->m_tx = tx;
+      output->m_amount = transfer->m_amount;
+      output->m_index = rng() % 10000000;
+      output->m_account_index = 0;
+      output->m_subaddress_index = j;
+      output->m_is_spent = false;
+      output->m_is_frozen = false;
+      output->m_key_image = make_shared<monero_key_image>();
+      output->m_key_image.get()->m_hex = epee::string_tools::pod_to_hex(random_pod<crypto::key_image>(rng));
+      output->m_stealth_public_key = epee::string_tools::pod_to_hex(random_pod<crypto::public_key>(rng));
+      tx->m_outputs.push_back(output);
+    }
+    if (tx->m_is_outgoing.get()) {
+      shared_ptr<monero_outgoing_transfer> transfer = make_shared<monero_outgoing_transfer>();
+      transfer->m_tx = tx;
+      transfer->m_amount = rng() % 1000000000000;
+      transfer->m_account_index = 0;
+      transfer->m_subaddress_indices.push_back(0);
+      transfer->m_destinations.push_back(make_shared<monero_destination>(string(95, 'x'), transfer->m_amount));
+      tx->m_outgoing_transfer = transfer;
+    }
+  }
+  return block;
+}
+
+cryptonote::transaction build_cn_tx(mt19937_64& rng, uint64_t height, size_t num_inputs, size_t num_outputs, bool is_miner_tx) {
+  cryptonote::transaction tx;
+  tx.version = 1;
+  tx.unlock_time = is_miner_tx ? height + CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW : 0;
+  if (is_miner_tx) {
+    cryptonote::txin_gen in;
+    in.height = height;
+    tx.vin.push_back(in);
+  } else {
+    for (size_t i = 0; i < num_inputs; i++) {
+      cryptonote::txin_to_key in;
+      in.amount = rng() % 1000000000000;
+      for (int j = 0; j < 11; j++) in.key_offsets.push_back(rng() % 100000);
+      in.k_image = random_pod<crypto::key_image>(rng);
+      tx.vin.push_back(in);
+      vector<crypto::signature> signatures;
+      for (size_t j = 0; j < in.key_offsets.size(); j++) signatures.push_back(random_pod<crypto::signature>(rng));
+      tx.signatures.push_back(signatures);
+    }
+  }
+  for (size_t i = 0; i < num_outputs; i++) {
+    cryptonote::txout_to_key target;
+    target.key = random_pod<crypto::public_key>(rng);
+    cryptonote::tx_out out;
+    out.amount = rng() % 1000000000000;
+    out.target = target;
+    tx.vout.push_back(out);
+  }
+  return tx;
+}
+
+// ---------------------------- SYNTHETIC CHAIN -------------------------------
+
+struct owned_output {
+  crypto::key_image m_key_image;
+  uint64_t m_amount;
+};
+
+struct synthetic_chain {
+  vector<cryptonote::block_complete_entry> m_blocks;
+  vector<wallet_accessor_test::parsed_block> m_parsed_blocks;
+};
+
+/**
+ * Add outputs paying a wallet's subaddress to a tx and record their key images so
+ * later txs can spend them.
+ */
+void add_outputs_to_wallet(mt19937_64& rng, const tools::wallet2& w2, cryptonote::transaction& tx, uint32_t subaddress_idx, const vector<uint64_t>& amounts, vector<owned_output>& outputs) {
+  cryptonote::subaddress_index index = {0, subaddress_idx};
+  cryptonote::account_public_address address = w2.get_subaddress(index);
+
+  // derive the tx public key and shared secret for the subaddress
+  crypto::secret_key tx_key = random_scalar(rng);
+  crypto::public_key tx_pub_key;
+  if (subaddress_idx == 0) crypto::secret_key_to_public_key(tx_key, tx_pub_key);
+  else tx_pub_key = rct::rct2pk(rct::scalarmultKey(rct::pk2rct(address.m_spend_public_key), rct::sk2rct(tx_key)));
+  cryptonote::add_tx_pub_key_to_extra(tx, tx_pub_key);
+  crypto::key_derivation derivation;
+  if (!crypto::generate_key_derivation(address.m_view_public_key, tx_key, derivation)) throw runtime_error("Failed to derive shared secret");
+
+  // add outputs
+  unordered_map<crypto::public_key, cryptonote::subaddress_index> subaddresses = {{address.m_spend_public_key, index}};
+  for (uint64_t amount : amounts) {
+    size_t output_idx = tx.vout.size();
+    cryptonote::txout_to_key target;
+    if (!crypto::derive_public_key(derivation, output_idx, address.m_spend_public_key, target.key)) throw runtime_error("Failed to derive output key");
+    cryptonote::tx_out out;
+    out.amount = amount;
+    out.target = target;
+    tx.vout.push_back(out);
+    cryptonote::keypair ephemeral;
+    owned_output output;
+    output.m_amount = amount;
+    if (!cryptonote::generate_key_image_helper(w2.get_account().get_keys(), subaddresses, target.key, tx_pub_key, {}, output_idx, ephemeral, output.m_key_image, w2.get_account().get_device())) throw runtime_error("Failed to generate key image");
+    outputs.push_back(output);
+  }
+}
+
+void add_input(mt19937_64& rng, cryptonote::transaction& tx, uint64_t amount, const crypto::key_image& key_image) {
+  cryptonote::txin_to_key in;
+  in.amount = amount;
+  for (int i = 0; i < 11; i++) in.key_offsets.push_back(rng() % 100000);
+  in.k_image = key_image;
+  tx.vin.push_back(in);
+  vector<crypto::signature> signatures;
+  for (size_t i = 0; i < in.key_offsets.size(); i++) signatures.push_back(random_pod<crypto::signature>(rng));
+  tx.signatures.push_back(signatures);
+}
+
+void add_output(mt19937_64& rng, cryptonote::transaction& tx, uint64_t amount) {
+  cryptonote::txout_to_key target;
+  target.key = random_pod<crypto::public_key>(rng);
+  cryptonote::tx_out out;
+  out.amount = amount;
+  out.target = target;
+  tx.vout.push_back(out);
+}
+
+/**
+ * Build a chain of blocks which pays a wallet across subaddresses and spends its
+ * outputs with change, so replaying it produces incoming and outgoing history.
+ * Every tenth block's miner tx pays the wallet a locked coinbase output.
+ */
+synthetic_chain build_synthetic_chain(mt19937_64& rng, const tools::wallet2& w2, uint64_t start_height, size_t num_blocks) {
+  synthetic_chain chain;
+  vector<owned_output> spendable;
+  uint64_t global_output_idx = 0;
+  for (size_t i = 0; i < num_blocks; i++) {
+    uint64_t height = start_height + i;
+    vector<owned_output> received; // spendable from the next block
+
+    // build miner tx
+    cryptonote::transaction miner_tx;
+    if (i % 10 == 0) {
+      miner_tx.version = 1;
+      miner_tx.unlock_time = height + CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW;
+      cryptonote::txin_gen in;
+      in.height = height;
+      miner_tx.vin.push_back(in);
+      add_outputs_to_wallet(rng, w2, miner_tx, 0, vector<uint64_t>{ 1000000000000 + rng() % 1000000000000 }, received);
+    } else {
+      miner_tx = build_cn_tx(rng, height, 0, 1, true);
+    }
+
+    // build txs which alternate between paying a subaddress and spending an output with change
+    vector<cryptonote::transaction> txs;
+    for (size_t j = 0; j < TXS_PER_BLOCK; j++) {
+      cryptonote::transaction tx;
+      tx.version = 1;
+      tx.unlock_time = 0;
+      if (j % 2 == 1 && !spendable.empty()) {
+        size_t spent_idx = rng() % spendable.size();
+        owned_output spent = spendable[spent_idx];
+        spendable[spent_idx] = spendable.back();
+        spendable.pop_back();
+        add_input(rng, tx, spent.m_amount, spent.m_key_image);
+        add_outputs_to_wallet(rng, w2, tx, 0, vector<uint64_t>{ spent.m_amount / 2 }, received);
+        add_output(rng, tx, spent.m_amount / 4);
+      } else {
+        vector<uint64_t> amounts{ 1000000 + rng() % 1000000000000, 1000000 + rng() % 1000000000000 };
+        add_input(rng, tx, amounts[0] + amounts[1] + 100000000, random_pod<crypto::key_image>(rng));
+        add_outputs_to_wallet(rng, w2, tx, rng() % NUM_SUBADDRESSES, amounts, received);
+      }
+      txs.push_back(tx);
+    }
+
+    // assemble block as the wallet receives it from a daemon
+    wallet_accessor_test::parsed_block parsed;
+    parsed.block.major_version = 1;
+    parsed.block.minor_version = 0;
+    parsed.block.timestamp = 1577836800 + i * 120;
+    parsed.block.prev_id = random_pod<crypto::hash>(rng);
+    parsed.block.nonce = static_cast<uint32_t>(rng());
+    parsed.block.miner_tx = miner_tx;
+    cryptonote::block_complete_entry entry;
+    cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::tx_output_indices miner_indices;
+    for (size_t k = 0; k < miner_tx.vout.size(); k++) miner_indices.indices.push_back(global_output_idx++);
+    parsed.o_indices.indices.push_back(miner_indices);
+    for (const cryptonote::transaction& tx : txs) {
+      parsed.block.tx_hashes.push_back(cryptonote::get_transaction_hash(tx));
+      entry.txs.push_back(cryptonote::tx_blob_entry(cryptonote::tx_to_blob(tx)));
+      cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::tx_output_indices tx_indices;
+      for (size_t k = 0; k < tx.vout.size(); k++) tx_indices.indices.push_back(global_output_idx++);
+      parsed.o_indices.indices.push_back(tx_indices);
+    }
+    parsed.txes = txs;
+    parsed.hash = cryptonote::get_block_hash(parsed.block);
+    parsed.error = false;
+    entry.block = cryptonote::block_to_blob(parsed.block);
+    chain.m_blocks.push_back(entry);
+    chain.m_parsed_blocks.push_back(parsed);
+    spendable.insert(spendable.end(), received.begin(), received.end());
+  }
+  return chain;
+}
+
+/**
+ * Build a binary get_blocks_by_height response like a daemon would return.
+ */
+string build_binary_blocks(mt19937_64& rng, size_t num_blocks, size_t txs_per_block) {
+  cryptonote::COMMAND_RPC_GET_BLOCKS_BY_HEIGHT::response resp;
+  for (size_t i = 0; i < num_blocks; i++) {
+    uint64_t height = 100000 + i;
+    cryptonote::block block;
+    block.major_version = 1;
+    block.minor_version = 0;
+    block.timestamp = 1577836800 + i * 120;
+    block.prev_id = random_pod<crypto::hash>(rng);
+    block.nonce = static_cast<uint32_t>(rng());
+    block.miner_tx = build_cn_tx(rng, height, 0, 1, true);
+    cryptonote::block_complete_entry entry;
+    for (size_t j = 0; j < txs_per_block; j++) {
+      cryptonote::transaction tx = build_cn_tx(rng, height, 2, 2, false);
+      block.tx_hashes.push_back(cryptonote::get_transaction_hash(tx));
+      entry.txs.push_back(cryptonote::tx_blob_entry(cryptonote::tx_to_blob(tx)));
+    }
+    entry.block = cryptonote::block_to_blob(block);
+    resp.blocks.push_back(entry);
+  }
+  resp.status = CORE_RPC_STATUS_OK;
+  string bin;
+  epee::serialization::store_t_to_binary(resp, bin);
+  return bin;
+}
+
+// ---------------------------------- MAIN ------------------------------------
+
+/**
+ * Benchmark entry point.
+ */
+int main(int argc, const char* argv[]) {
+
+  // configure logging
+  mlog_configure("log_cpp_bench.txt", true);
+  mlog_set_log_level(0);
+
+  // parse arguments
+  int iterations = 20;
+  size_t num_blocks = DEFAULT_NUM_BLOCKS;
+  string keys_path;
+  string cache_path;
+  string password = "supersecretpassword123";
+  monero_network_type network_type = monero_network_type::STAGENET;
+  string daemon_uri;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    string arg = argv[i];
+    if (arg == "--iterations") iterations = stoi(argv[i + 1]);
+    else if (arg == "--blocks") num_blocks = stoul(argv[i + 1]);
+    else if (arg == "--keys") keys_path = argv[i + 1];
+    else if (arg == "--cache") cache_path = argv[i + 1];
+    else if (arg == "--password") password = argv[i + 1];
+    else if (arg == "--network") network_type = static_cast<monero_network_type>(stoi(argv[i + 1]));
+    else if (arg == "--daemon") daemon_uri = argv[i + 1];
+    else throw runtime_error("Unknown argument: " + arg);
+  }
+  mt19937_64 rng(SEED);
+
+  // generate a wallet from the seed and replay a synthetic chain into it
+  tools::wallet2 synthetic_w2(static_cast<cryptonote::network_type>(network_type), 1, true);
+  synthetic_w2.generate("", password, random_scalar(rng), true, false);
+  uint64_t start_height = synthetic_w2.get_blockchain_current_height();
+  synthetic_chain chain = build_synthetic_chain(rng, synthetic_w2, start_height, num_blocks);
+  wallet_accessor_test::process_parsed_blocks(synthetic_w2, start_height, chain.m_blocks, chain.m_parsed_blocks);
+
+  // load wallet state through open_wallet_data()
+  string keys_data;
+  string cache_data;
+  if (!keys_path.empty()) {
+    keys_data = read_file(keys_path);
+    cache_data = cache_path.empty() ? string() : read_file(cache_path);
+  } else {
+    ::serialization::dump_binary(synthetic_w2.get_keys_file_data(password, false).get(), keys_data);
+    ::serialization::dump_binary(synthetic_w2.get_cache_file_data(password).get(), cache_data);
+  }
+  unique_ptr<monero_wallet_core> wallet(monero_wallet_core::open_wallet_data(password, network_type, keys_data, cache_data));
+  unique_ptr<monero_wallet_keys> wallet_keys(monero_wallet_keys::create_wallet_from_keys(network_type, wallet->get_primary_address(), wallet->get_private_view_key(), wallet->get_private_spend_key()));
+
+  cout << left << setw(40) << "benchmark" << right << setw(8) << "iters" << setw(14) << "min us" << setw(14) << "median us" << setw(14) << "mean us" << endl;
+
+  // wallet queries
+  run_bench("get_txs", iterations, [&]() { free_txs(wallet->get_txs()); });
+  run_bench("get_txs (arena)", iterations, [&]() {
+    monero_result_arena arena;
+    wallet->get_txs(monero_tx_query(), arena);
+  });
+  run_bench("get_transfers", iterations, [&]() { free_results(wallet->get_transfers(monero_transfer_query())); });
+  run_bench("get_outputs", iterations, [&]() { free_results(wallet->get_outputs(monero_output_query())); });
+  run_bench("get_accounts with subaddresses", iterations, [&]() { wallet->get_accounts(true); });
+
+  // block processing of a sync without network
+  run_bench("replay " + to_string(num_blocks) + "x" + to_string(TXS_PER_BLOCK) + " blocks", iterations, [&]() {
+    synthetic_w2.rescan_blockchain(false, false);
+    wallet_accessor_test::process_parsed_blocks(synthetic_w2, start_height, chain.m_blocks, chain.m_parsed_blocks);
+  });
+
+  // serialization
+  shared_ptr<monero_block> graph = build_tx_graph(rng, 1000);
+  run_bench("serialize 1000 tx graph", iterations, [&]() { graph->serialize(); });
+  string blocks_bin = build_binary_blocks(rng, 100, 10);
+  run_bench("binary_blocks_to_json 100x10", iterations, [&]() {
+    string json;
+    monero_utils::binary_blocks_to_json(blocks_bin, json);
+  });
+
+  // address derivation
+  run_bench("get_address x1000", iterations, [&]() {
+    for (uint32_t i = 0; i < 1000; i++) wallet_keys->get_address(0, i);
+  });
+  vector<string> addresses;
+  run_bench("get_addresses x100000", iterations, [&]() { wallet_keys->get_addresses(0, 0, 100000, addresses); });
+
+  // tx creation needs a daemon for decoys and fees
+  if (!daemon_uri.empty()) {
+    wallet->set_daemon_connection(daemon_uri, "", "");
+    wallet->sync();
+    monero_tx_config config;
+    config.m_address = wallet->get_primary_address();
+    config.m_amount = 1000000;
+    config.m_relay = false;
+    try {
+      run_bench("create_txs", iterations, [&]() { free_txs(wallet->create_txs(config)); });
+    } catch (const exception& e) {
+      cout << left << setw(40) << "create_txs" << "skipped: " << e.what() << endl;
+    }
+  }
+
+  // break tx <-> block cycles
+  for (const shared_ptr<monero_tx>& tx : graph->m_txs) tx->m_block = boost::none;
+  return 0;
+}